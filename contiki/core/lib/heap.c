@@ -0,0 +1,145 @@
+/**
+ * \addtogroup heap
+ * @{
+ */
+
+/**
+ * \file
+ *         Binary min-heap library
+ */
+
+#include "lib/heap.h"
+
+#include <stddef.h>
+
+/*---------------------------------------------------------------------------*/
+static void
+place(struct heap *h, struct heap_node *n, uint16_t i)
+{
+  h->nodes[i] = n;
+  n->index = i;
+}
+/*---------------------------------------------------------------------------*/
+static void
+sift_up(struct heap *h, uint16_t i)
+{
+  struct heap_node *n;
+  uint16_t parent;
+
+  n = h->nodes[i];
+  while(i > 0) {
+    parent = (i - 1) / 2;
+    if(h->nodes[parent]->key <= n->key) {
+      break;
+    }
+    place(h, h->nodes[parent], i);
+    i = parent;
+  }
+  place(h, n, i);
+}
+/*---------------------------------------------------------------------------*/
+static void
+sift_down(struct heap *h, uint16_t i)
+{
+  struct heap_node *n;
+  uint16_t child;
+
+  n = h->nodes[i];
+  for(;;) {
+    child = 2 * i + 1;
+    if(child >= h->count) {
+      break;
+    }
+    if(child + 1 < h->count &&
+       h->nodes[child + 1]->key < h->nodes[child]->key) {
+      child++;
+    }
+    if(n->key <= h->nodes[child]->key) {
+      break;
+    }
+    place(h, h->nodes[child], i);
+    i = child;
+  }
+  place(h, n, i);
+}
+/*---------------------------------------------------------------------------*/
+void
+heap_node_init(struct heap_node *n)
+{
+  n->index = HEAP_NONE;
+}
+/*---------------------------------------------------------------------------*/
+void
+heap_init(struct heap *h)
+{
+  h->count = 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+heap_set(struct heap *h, struct heap_node *n, uint32_t key)
+{
+  uint32_t old;
+
+  if(!heap_member(n)) {
+    if(h->count == h->size) {
+      return 0;
+    }
+    n->key = key;
+    place(h, n, h->count++);
+    sift_up(h, n->index);
+    return 1;
+  }
+
+  old = n->key;
+  n->key = key;
+  if(key < old) {
+    sift_up(h, n->index);
+  } else if(key > old) {
+    sift_down(h, n->index);
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+void
+heap_remove(struct heap *h, struct heap_node *n)
+{
+  struct heap_node *last;
+  uint16_t i;
+
+  if(!heap_member(n)) {
+    return;
+  }
+  i = n->index;
+  n->index = HEAP_NONE;
+  last = h->nodes[--h->count];
+  if(last == n) {
+    return;
+  }
+  /* Put the last node in the hole and restore the order around it */
+  place(h, last, i);
+  if(i > 0 && h->nodes[(i - 1) / 2]->key > last->key) {
+    sift_up(h, i);
+  } else {
+    sift_down(h, i);
+  }
+}
+/*---------------------------------------------------------------------------*/
+struct heap_node *
+heap_peek(struct heap *h)
+{
+  return h->count > 0 ? h->nodes[0] : NULL;
+}
+/*---------------------------------------------------------------------------*/
+struct heap_node *
+heap_pop(struct heap *h)
+{
+  struct heap_node *n;
+
+  n = heap_peek(h);
+  if(n != NULL) {
+    heap_remove(h, n);
+  }
+  return n;
+}
+/*---------------------------------------------------------------------------*/
+/** @} */
@@ -0,0 +1,81 @@
+/** \addtogroup lib
+    @{ */
+/**
+ * \defgroup heap Binary min-heap library
+ *
+ * The heap library keeps elements ordered by a 32-bit key, the
+ * smallest first, typically an absolute deadline. Elements embed a
+ * struct heap_node, or own one kept beside them, which remembers its
+ * position in the heap, so that the key of an element can be changed
+ * or the element removed in O(log n).
+ *
+ * Heaps are declared with the HEAP() macro, which also reserves room
+ * for the given number of nodes. Nodes must be initialized with
+ * heap_node_init() before their first heap_set().
+ *
+ * @{
+ */
+
+/**
+ * \file
+ *         Binary min-heap library
+ */
+
+#ifndef __HEAP_H__
+#define __HEAP_H__
+
+#include "contiki-conf.h"
+#include "sys/cc.h"
+
+/** Index of a node that is in no heap */
+#define HEAP_NONE 0xffff
+
+struct heap_node {
+  uint32_t key;
+  uint16_t index;
+};
+
+struct heap {
+  struct heap_node **nodes;
+  uint16_t size;
+  uint16_t count;
+};
+
+/**
+ * Declare a heap of at most size nodes.
+ */
+#define HEAP(name, size)                                        \
+  static struct heap_node *CC_CONCAT(name,_nodes)[size];        \
+  static struct heap name = { CC_CONCAT(name,_nodes), size, 0 }
+
+/** True when the node is in a heap */
+#define heap_member(n) ((n)->index != HEAP_NONE)
+
+/** Mark a node as in no heap */
+void heap_node_init(struct heap_node *n);
+
+/** Empty a heap; the nodes it held are not touched */
+void heap_init(struct heap *h);
+
+/**
+ * Insert a node with the key, or move it to the key if it is in the
+ * heap already. Returns 0 if the heap is full.
+ */
+int heap_set(struct heap *h, struct heap_node *n, uint32_t key);
+
+/** Remove a node, if it is in the heap */
+void heap_remove(struct heap *h, struct heap_node *n);
+
+/** The node with the smallest key, NULL if the heap is empty */
+struct heap_node *heap_peek(struct heap *h);
+
+/** Remove and return the node with the smallest key */
+struct heap_node *heap_pop(struct heap *h);
+
+/** Number of nodes in the heap */
+#define heap_count(h) ((h)->count)
+
+#endif /* __HEAP_H__ */
+
+/** @} */
+/** @} */
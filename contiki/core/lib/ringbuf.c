@@ -39,6 +39,18 @@
  */
 
 #include "lib/ringbuf.h"
+
+/*
+ * When the producer and the consumer run on different CPUs, the slot
+ * must be written before the put pointer moves and read before the get
+ * pointer moves. An interrupt handler needs no more than the compiler
+ * ordering the 8-bit accesses, a thread needs a memory barrier.
+ */
+#ifdef RINGBUF_CONF_BARRIER
+#define RINGBUF_BARRIER() RINGBUF_CONF_BARRIER()
+#else
+#define RINGBUF_BARRIER()
+#endif
 /*---------------------------------------------------------------------------*/
 void
 ringbuf_init(struct ringbuf *r, uint8_t *dataptr, uint8_t size)
@@ -64,7 +76,9 @@ ringbuf_put(struct ringbuf *r, uint8_t c)
   if(((r->put_ptr - r->get_ptr) & r->mask) == r->mask) {
     return 0;
   }
+  RINGBUF_BARRIER();
   r->data[r->put_ptr] = c;
+  RINGBUF_BARRIER();
   r->put_ptr = (r->put_ptr + 1) & r->mask;
   return 1;
 }
@@ -85,7 +99,9 @@ ringbuf_get(struct ringbuf *r)
      most platforms, but C does not guarantee this.
   */
   if(((r->put_ptr - r->get_ptr) & r->mask) > 0) {
+    RINGBUF_BARRIER();
     c = r->data[r->get_ptr];
+    RINGBUF_BARRIER();
     r->get_ptr = (r->get_ptr + 1) & r->mask;
     return c;
   } else {
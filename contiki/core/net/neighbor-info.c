@@ -139,6 +139,7 @@ neighbor_info_packet_sent(int status, int numtx)
        (nbr->state == STALE || nbr->state == DELAY || nbr->state == PROBE)) {
       nbr->state = REACHABLE;
       stimer_set(&nbr->reachable, UIP_ND6_REACHABLE_TIME / 1000);
+      uip_ds6_nbr_schedule(nbr);
       PRINTF("neighbor-info : received a link layer ACK : ");
       PRINTLLADDR((uip_lladdr_t *)dest);
       PRINTF(" is reachable.\n");
@@ -154,4 +154,215 @@
 #define RPL_DIO_REDUNDANCY          10
 #endif
 
+/*
+ * DTSN policy. Advertising a new DTSN in the DIO makes the whole
+ * sub-DODAG send new DAOs, so the root should only do it when it needs
+ * them.
+ *
+ * RPL_DTSN_ALWAYS increments the DTSN on every DIO, which turns every
+ * Trickle firing into a DAO storm. RPL_DTSN_ON_DEMAND increments it on
+ * a repair, when routes are lost, and every RPL_DTSN_REFRESH_PERIOD
+ * seconds at the root, at most once a second under churn. RPL_DTSN_PACED,
+ * the default, acts on the same triggers but lets at least
+ * RPL_DTSN_MIN_INTERVAL seconds pass between two increments, merging the
+ * requests that come in between.
+ */
+#define RPL_DTSN_ALWAYS             0
+#define RPL_DTSN_ON_DEMAND          1
+#define RPL_DTSN_PACED              2
+
+#ifdef RPL_CONF_DTSN_POLICY
+#define RPL_DTSN_POLICY             RPL_CONF_DTSN_POLICY
+#else
+#define RPL_DTSN_POLICY             RPL_DTSN_PACED
+#endif
+
+/* Seconds between two DAO refreshes requested by the root, 0 for none */
+#ifdef RPL_CONF_DTSN_REFRESH_PERIOD
+#define RPL_DTSN_REFRESH_PERIOD     RPL_CONF_DTSN_REFRESH_PERIOD
+#else
+#define RPL_DTSN_REFRESH_PERIOD     3600
+#endif
+
+/* Minimum number of seconds between two increments in paced mode */
+#ifdef RPL_CONF_DTSN_MIN_INTERVAL
+#define RPL_DTSN_MIN_INTERVAL       RPL_CONF_DTSN_MIN_INTERVAL
+#else
+#define RPL_DTSN_MIN_INTERVAL       60
+#endif
+
+/*
+ * DIS handling. Each source gets a token bucket of RPL_DIS_BURST
+ * solicitations, refilled by one token every RPL_DIS_TOKEN_INTERVAL
+ * seconds; sources are tracked in a table of RPL_DIS_SOURCES entries.
+ * Unicast DIS replies wait RPL_DIS_REPLY_DELAY; when RPL_DIS_COALESCE
+ * or more are pending they are answered by one multicast DIO instead.
+ * A multicast DIS resets Trickle at most once every
+ * RPL_DIS_RESET_MIN_INTERVAL seconds.
+ */
+#ifdef RPL_CONF_DIS_SOURCES
+#define RPL_DIS_SOURCES             RPL_CONF_DIS_SOURCES
+#else
+#define RPL_DIS_SOURCES             32
+#endif
+
+#ifdef RPL_CONF_DIS_BURST
+#define RPL_DIS_BURST               RPL_CONF_DIS_BURST
+#else
+#define RPL_DIS_BURST               3
+#endif
+
+#ifdef RPL_CONF_DIS_TOKEN_INTERVAL
+#define RPL_DIS_TOKEN_INTERVAL      RPL_CONF_DIS_TOKEN_INTERVAL
+#else
+#define RPL_DIS_TOKEN_INTERVAL      10
+#endif
+
+#ifdef RPL_CONF_DIS_PENDING
+#define RPL_DIS_PENDING             RPL_CONF_DIS_PENDING
+#else
+#define RPL_DIS_PENDING             8
+#endif
+
+#ifdef RPL_CONF_DIS_COALESCE
+#define RPL_DIS_COALESCE            RPL_CONF_DIS_COALESCE
+#else
+#define RPL_DIS_COALESCE            4
+#endif
+
+#ifdef RPL_CONF_DIS_REPLY_DELAY
+#define RPL_DIS_REPLY_DELAY         RPL_CONF_DIS_REPLY_DELAY
+#else
+#define RPL_DIS_REPLY_DELAY         (CLOCK_SECOND / 4)
+#endif
+
+#ifdef RPL_CONF_DIS_RESET_MIN_INTERVAL
+#define RPL_DIS_RESET_MIN_INTERVAL  RPL_CONF_DIS_RESET_MIN_INTERVAL
+#else
+#define RPL_DIS_RESET_MIN_INTERVAL  10
+#endif
+
+/*
+ * Adaptive Trickle at the root. Every RPL_ADAPT_PERIOD seconds the root
+ * looks at the DODAG size and at the DAO and DIS received in the period
+ * and retunes the DIO interval and redundancy it advertises, within the
+ * bounds below. Imin doubles each time the DODAG doubles beyond
+ * RPL_ADAPT_SIZE_BASE nodes. The DODAG counts as unstable when more
+ * than RPL_ADAPT_CHURN_PERCENT of its nodes sent a DAO or more than
+ * RPL_ADAPT_DIS_THRESHOLD DIS came in; doublings then go down and
+ * redundancy up, and the other way round while it is quiet.
+ */
+#ifdef RPL_CONF_ADAPTIVE_TRICKLE
+#define RPL_ADAPTIVE_TRICKLE        RPL_CONF_ADAPTIVE_TRICKLE
+#else
+#define RPL_ADAPTIVE_TRICKLE        1
+#endif
+
+#ifdef RPL_CONF_ADAPT_PERIOD
+#define RPL_ADAPT_PERIOD            RPL_CONF_ADAPT_PERIOD
+#else
+#define RPL_ADAPT_PERIOD            60
+#endif
+
+#ifdef RPL_CONF_ADAPT_IMIN_MIN
+#define RPL_ADAPT_IMIN_MIN          RPL_CONF_ADAPT_IMIN_MIN
+#else
+#define RPL_ADAPT_IMIN_MIN          RPL_DIO_INTERVAL_MIN
+#endif
+
+#ifdef RPL_CONF_ADAPT_IMIN_MAX
+#define RPL_ADAPT_IMIN_MAX          RPL_CONF_ADAPT_IMIN_MAX
+#else
+#define RPL_ADAPT_IMIN_MAX          (RPL_DIO_INTERVAL_MIN + 4)
+#endif
+
+#ifdef RPL_CONF_ADAPT_DOUBLINGS_MIN
+#define RPL_ADAPT_DOUBLINGS_MIN     RPL_CONF_ADAPT_DOUBLINGS_MIN
+#else
+#define RPL_ADAPT_DOUBLINGS_MIN     4
+#endif
+
+#ifdef RPL_CONF_ADAPT_DOUBLINGS_MAX
+#define RPL_ADAPT_DOUBLINGS_MAX     RPL_CONF_ADAPT_DOUBLINGS_MAX
+#else
+#define RPL_ADAPT_DOUBLINGS_MAX     12
+#endif
+
+#ifdef RPL_CONF_ADAPT_REDUNDANCY_MIN
+#define RPL_ADAPT_REDUNDANCY_MIN    RPL_CONF_ADAPT_REDUNDANCY_MIN
+#else
+#define RPL_ADAPT_REDUNDANCY_MIN    3
+#endif
+
+#ifdef RPL_CONF_ADAPT_REDUNDANCY_MAX
+#define RPL_ADAPT_REDUNDANCY_MAX    RPL_CONF_ADAPT_REDUNDANCY_MAX
+#else
+#define RPL_ADAPT_REDUNDANCY_MAX    RPL_DIO_REDUNDANCY
+#endif
+
+#ifdef RPL_CONF_ADAPT_SIZE_BASE
+#define RPL_ADAPT_SIZE_BASE         RPL_CONF_ADAPT_SIZE_BASE
+#else
+#define RPL_ADAPT_SIZE_BASE         32
+#endif
+
+#ifdef RPL_CONF_ADAPT_CHURN_PERCENT
+#define RPL_ADAPT_CHURN_PERCENT     RPL_CONF_ADAPT_CHURN_PERCENT
+#else
+#define RPL_ADAPT_CHURN_PERCENT     25
+#endif
+
+#ifdef RPL_CONF_ADAPT_DIS_THRESHOLD
+#define RPL_ADAPT_DIS_THRESHOLD     RPL_CONF_ADAPT_DIS_THRESHOLD
+#else
+#define RPL_ADAPT_DIS_THRESHOLD     4
+#endif
+
+/*
+ * Repair pacing at the root. A new version or DTSN in a multicast DIO
+ * makes every child of the root send its DAO, and refresh its own
+ * sub-DODAG, within a few RPL_DAO_LATENCY. With pacing the root holds
+ * its multicast DIOs and hands the new DIO to its neighbors by unicast
+ * instead, so the sub-DODAGs re-register one after the other. The
+ * number of neighbors released each second grows while fewer than
+ * RPL_REPAIR_DAO_RATE DAOs a second come in, up to RPL_REPAIR_BATCH_MAX,
+ * and is halved when more do. After RPL_REPAIR_WINDOW seconds the
+ * neighbors left get the multicast DIO.
+ */
+#ifdef RPL_CONF_REPAIR_PACING
+#define RPL_REPAIR_PACING           RPL_CONF_REPAIR_PACING
+#else
+#define RPL_REPAIR_PACING           (RPL_DTSN_POLICY != RPL_DTSN_ALWAYS)
+#endif
+
+#ifdef RPL_CONF_REPAIR_DAO_RATE
+#define RPL_REPAIR_DAO_RATE         RPL_CONF_REPAIR_DAO_RATE
+#else
+#define RPL_REPAIR_DAO_RATE         50
+#endif
+
+#ifdef RPL_CONF_REPAIR_BATCH_MAX
+#define RPL_REPAIR_BATCH_MAX        RPL_CONF_REPAIR_BATCH_MAX
+#else
+#define RPL_REPAIR_BATCH_MAX        16
+#endif
+
+#ifdef RPL_CONF_REPAIR_WINDOW
+#define RPL_REPAIR_WINDOW           RPL_CONF_REPAIR_WINDOW
+#else
+#define RPL_REPAIR_WINDOW           300
+#endif
+
+/*
+ * Seconds the routes of a previous DODAG version, or of a DAG replaced
+ * by rpl_set_root(), stay installed when no DAO refreshes them. A paced
+ * repair may take RPL_REPAIR_WINDOW seconds to reach the last neighbor,
+ * whose DAOs must still find its routes in place.
+ */
+#ifdef RPL_CONF_ROUTE_STALE_GRACE
+#define RPL_ROUTE_STALE_GRACE       RPL_CONF_ROUTE_STALE_GRACE
+#else
+#define RPL_ROUTE_STALE_GRACE       (RPL_REPAIR_WINDOW + 60)
+#endif
+
 #endif /* RPL_CONF_H */
@@ -68,6 +68,13 @@ static rpl_of_t * const objective_functions[] = {&RPL_OF};
 #define RPL_MAX_PARENTS_PER_DAG       RPL_CONF_MAX_PARENTS_PER_DAG
 #endif /* !RPL_CONF_MAX_PARENTS_PER_DAG */
 
+/* Buckets of the parent address index, a power of two */
+#ifndef RPL_CONF_PARENT_HASH_SIZE
+#define RPL_PARENT_HASH_SIZE          64
+#else
+#define RPL_PARENT_HASH_SIZE          RPL_CONF_PARENT_HASH_SIZE
+#endif /* !RPL_CONF_PARENT_HASH_SIZE */
+
 /************************************************************************/
 /* RPL definitions. */
 
@@ -81,6 +88,11 @@ static rpl_of_t * const objective_functions[] = {&RPL_OF};
 /* Allocate parents from the same static MEMB chunk to reduce memory waste. */
 MEMB(parent_memb, struct rpl_parent,
      RPL_MAX_PARENTS_PER_DAG * RPL_MAX_INSTANCES * RPL_MAX_DAG_PER_INSTANCE);
+/*
+ * Every parent of every DAG, chained by address hash, so that DIO and
+ * DAO input find the sender without walking the parent lists.
+ */
+static rpl_parent_t *parent_hash[RPL_PARENT_HASH_SIZE];
 /************************************************************************/
 /* Allocate instance table. */
 rpl_instance_t instance_table[RPL_MAX_INSTANCES];
@@ -88,8 +100,8 @@ rpl_instance_t *default_instance;
 /************************************************************************/
 /* Greater-than function for the lollipop counter.                      */
 /************************************************************************/
-static int
-lollipop_greater_than(int a, int b)
+int
+rpl_lollipop_greater_than(int a, int b)
 {
   /* Check if we are comparing an initial value with an old value */
   if(a > RPL_LOLLIPOP_CIRCULAR_REGION && b <= RPL_LOLLIPOP_CIRCULAR_REGION) {
@@ -102,6 +114,59 @@ lollipop_greater_than(int a, int b)
 			 RPL_LOLLIPOP_SEQUENCE_WINDOWS));
 }
 /************************************************************************/
+static rpl_parent_t **
+parent_bucket(uip_ipaddr_t *addr)
+{
+  return &parent_hash[(addr->u8[12] ^ addr->u8[13] ^
+                       addr->u8[14] ^ addr->u8[15]) &
+                      (RPL_PARENT_HASH_SIZE - 1)];
+}
+/************************************************************************/
+static void
+parent_hash_add(rpl_parent_t *p)
+{
+  rpl_parent_t **bucket;
+
+  bucket = parent_bucket(&p->addr);
+  p->hash_next = *bucket;
+  *bucket = p;
+}
+/************************************************************************/
+static void
+parent_hash_remove(rpl_parent_t *p)
+{
+  rpl_parent_t **pp;
+
+  for(pp = parent_bucket(&p->addr); *pp != NULL; pp = &(*pp)->hash_next) {
+    if(*pp == p) {
+      *pp = p->hash_next;
+      return;
+    }
+  }
+}
+/************************************************************************/
+/*
+ * The parent with this address in a used DAG of the instance. Should
+ * several DAGs have it, the first one in dag_table wins, as it did when
+ * the lists were walked in order.
+ */
+static rpl_parent_t *
+parent_lookup(rpl_instance_t *instance, uip_ipaddr_t *addr)
+{
+  rpl_parent_t *p;
+  rpl_parent_t *found;
+
+  found = NULL;
+  for(p = *parent_bucket(addr); p != NULL; p = p->hash_next) {
+    if(p->dag->instance == instance && p->dag->used &&
+       uip_ipaddr_cmp(&p->addr, addr) &&
+       (found == NULL || p->dag < found->dag)) {
+      found = p;
+    }
+  }
+  return found;
+}
+/************************************************************************/
 /* Remove DAG parents with a rank that is at least the same as minimum_rank. */
 static void
 remove_parents(rpl_dag_t *dag, rpl_rank_t minimum_rank)
@@ -165,7 +230,7 @@ should_send_dao(rpl_instance_t *instance, rpl_dio_t *dio, rpl_parent_t *p)
   }
   /* check if the new DTSN is more recent */
   return p == instance->current_dag->preferred_parent &&
-    (lollipop_greater_than(dio->dtsn, p->dtsn));
+    (rpl_lollipop_greater_than(dio->dtsn, p->dtsn));
 }
 /************************************************************************/
 static int
@@ -214,6 +279,9 @@ rpl_set_root(uint8_t instance_id, uip_ipaddr_t *dag_id)
     if(dag == dag->instance->current_dag) {
       dag->instance->current_dag = NULL;
     }
+    /* Its routes stay until the new version refreshes or sweeps them */
+    rpl_stale_routes(dag);
+    rpl_move_routes(dag, NULL);
     rpl_free_dag(dag);
   }
 
@@ -249,15 +317,20 @@ rpl_set_root(uint8_t instance_id, uip_ipaddr_t *dag_id)
   dag->rank = ROOT_RANK(instance);
 
   if(instance->current_dag != dag && instance->current_dag != NULL) {
-    /* Remove routes installed by DAOs. */
-    rpl_remove_routes(instance->current_dag);
+    /* Keep the routes installed by DAOs for the grace period. */
+    rpl_stale_routes(instance->current_dag);
+    rpl_move_routes(instance->current_dag, NULL);
 
     instance->current_dag->joined = 0;
   }
 
   instance->current_dag = dag;
+  rpl_move_routes(NULL, dag);
   instance->dtsn_out = RPL_LOLLIPOP_INIT;
+  instance->dtsn_pending = 0;
+  instance->dtsn_age = 0;
   instance->of->update_metric_container(instance);
+  rpl_dio_invalidate(instance);
   default_instance = instance;
 
   PRINTF("RPL: Node set to be a DAG root with DAG ID ");
@@ -283,8 +356,9 @@ rpl_repair_root(uint8_t instance_id)
   }
 
   RPL_LOLLIPOP_INCREMENT(instance->current_dag->version);
-  RPL_LOLLIPOP_INCREMENT(instance->dtsn_out);
-  rpl_reset_dio_timer(instance);
+  rpl_stale_routes(instance->current_dag);
+  rpl_dtsn_increment(instance);
+  rpl_repair_start(instance);
   return 1;
 }
 /************************************************************************/
@@ -343,6 +417,7 @@ rpl_set_prefix(rpl_dag_t *dag, uip_ipaddr_t *prefix, unsigned len)
   memcpy(&dag->prefix_info.prefix, prefix, (len + 7) / 8);
   dag->prefix_info.length = len;
   dag->prefix_info.flags = UIP_ND6_RA_FLAG_AUTONOMOUS;
+  rpl_dio_invalidate(dag->instance);
   PRINTF("RPL: Prefix set - will announce this in DIOs\n");
   /* Autoconfigure an address if this node does not already have an address
      with this prefix. */
@@ -387,6 +462,8 @@ rpl_alloc_instance(uint8_t instance_id)
       memset(instance, 0, sizeof(*instance));
       instance->instance_id = instance_id;
       instance->def_route = NULL;
+      instance->link = uip_ds6_link;
+      instance->dao_sequence = RPL_LOLLIPOP_INIT;
       instance->used = 1;
       return instance;
     }
@@ -413,6 +490,7 @@ rpl_alloc_dag(uint8_t instance_id, uip_ipaddr_t *dag_id)
     if(!dag->used) {
       memset(dag, 0, sizeof(*dag));
       LIST_STRUCT_INIT(dag, parents);
+      dag->route_head = RPL_ROUTE_NONE;
       dag->used = 1;
       dag->rank = INFINITE_RANK;
       dag->min_rank = INFINITE_RANK;
@@ -451,6 +529,7 @@ rpl_free_instance(rpl_instance_t *instance)
 
   ctimer_stop(&instance->dio_timer);
   ctimer_stop(&instance->dao_timer);
+  ctimer_stop(&instance->dis_timer);
 
   if(default_instance == instance) {
     default_instance = NULL;
@@ -475,9 +554,10 @@ rpl_free_dag(rpl_dag_t *dag)
     if((dag->prefix_info.flags & UIP_ND6_RA_FLAG_AUTONOMOUS)) {
       check_prefix(&dag->prefix_info, NULL);
     }
-
-    remove_parents(dag, 0);
   }
+
+  /* Joined or not, no parent may outlive the slot it points to */
+  remove_parents(dag, 0);
   dag->used = 0;
 }
 /************************************************************************/
@@ -502,6 +582,8 @@ rpl_add_parent(rpl_dag_t *dag, rpl_dio_t *dio, uip_ipaddr_t *addr)
   p->link_metric = INITIAL_LINK_METRIC;
   memcpy(&p->mc, &dio->mc, sizeof(p->mc));
   list_add(dag->parents, p);
+  dag->parent_count++;
+  parent_hash_add(p);
   return p;
 }
 /************************************************************************/
@@ -510,8 +592,8 @@ rpl_find_parent(rpl_dag_t *dag, uip_ipaddr_t *addr)
 {
   rpl_parent_t *p;
 
-  for(p = list_head(dag->parents); p != NULL; p = p->next) {
-    if(uip_ipaddr_cmp(&p->addr, addr)) {
+  for(p = *parent_bucket(addr); p != NULL; p = p->hash_next) {
+    if(p->dag == dag && uip_ipaddr_cmp(&p->addr, addr)) {
       return p;
     }
   }
@@ -523,36 +605,15 @@ static rpl_dag_t *
 find_parent_dag(rpl_instance_t *instance, uip_ipaddr_t *addr)
 {
   rpl_parent_t *p;
-  rpl_dag_t *dag, *end;
 
-  for(dag = &instance->dag_table[0], end = dag + RPL_MAX_DAG_PER_INSTANCE; dag < end; ++dag) {
-    if(dag->used) {
-      for(p = list_head(dag->parents); p != NULL; p = p->next) {
-        if(uip_ipaddr_cmp(&p->addr, addr)) {
-          return dag;
-        }
-      }
-    }
-  }
-  return NULL;
+  p = parent_lookup(instance, addr);
+  return p != NULL ? p->dag : NULL;
 }
 /************************************************************************/
 rpl_parent_t *
 rpl_find_parent_any_dag(rpl_instance_t *instance, uip_ipaddr_t *addr)
 {
-  static rpl_parent_t *p;
-  static rpl_dag_t *dag, *end;
-
-  for(dag = &instance->dag_table[0], end = dag + RPL_MAX_DAG_PER_INSTANCE; dag < end; ++dag) {
-    if(dag->used) {
-      for(p = list_head(dag->parents); p != NULL; p = p->next) {
-        if(uip_ipaddr_cmp(&p->addr, addr)) {
-          return p;
-        }
-      }
-    }
-  }
-  return NULL;
+  return parent_lookup(instance, addr);
 }
 /************************************************************************/
 rpl_dag_t *
@@ -607,6 +668,7 @@ rpl_select_dag(rpl_instance_t *instance, rpl_parent_t *p)
     best_dag->joined = 1;
     instance->current_dag->joined = 0;
     instance->current_dag = best_dag;
+    rpl_dio_invalidate(instance);
   }
 
   instance->of->update_metric_container(instance);
@@ -635,7 +697,7 @@ rpl_select_dag(rpl_instance_t *instance, rpl_parent_t *p)
         dao_output(last_parent, RPL_ZERO_LIFETIME);
       }
       /* The DAO parent set changed - schedule a DAO transmission. */
-      RPL_LOLLIPOP_INCREMENT(instance->dtsn_out);
+      rpl_dtsn_increment(instance);
       rpl_schedule_dao(instance);
     }
     rpl_reset_dio_timer(instance);
@@ -679,6 +741,8 @@ rpl_remove_parent(rpl_dag_t *dag, rpl_parent_t *parent)
   PRINTF("\n");
 
   list_remove(dag->parents, parent);
+  dag->parent_count--;
+  parent_hash_remove(parent);
   memb_free(&parent_memb, parent);
 }
 /************************************************************************/
@@ -731,9 +795,12 @@ rpl_move_parent(rpl_dag_t *dag_src, rpl_dag_t *dag_dst, rpl_parent_t *parent)
   PRINT6ADDR(&parent->addr);
   PRINTF("\n");
 
+  /* The index is keyed by address only, the entry stays where it is */
   list_remove(dag_src->parents, parent);
+  dag_src->parent_count--;
   parent->dag = dag_dst;
   list_add(dag_dst->parents, parent);
+  dag_dst->parent_count++;
 }
 /************************************************************************/
 rpl_dag_t *
@@ -846,6 +913,7 @@ rpl_join_instance(uip_ipaddr_t *from, rpl_dio_t *dio)
 
   /* Copy prefix information from the DIO into the DAG object. */
   memcpy(&dag->prefix_info, &dio->prefix_info, sizeof(rpl_prefix_t));
+  rpl_dio_invalidate(instance);
 
   dag->preferred_parent = p;
   instance->of->update_metric_container(instance);
@@ -938,6 +1006,7 @@ rpl_add_dag(uip_ipaddr_t *from, rpl_dio_t *dio)
 
   /* copy prefix information into the dag */
   memcpy(&dag->prefix_info, &dio->prefix_info, sizeof(rpl_prefix_t));
+  rpl_dio_invalidate(instance);
 
   dag->preferred_parent = p;
   dag->rank = instance->of->calculate_rank(p, 0);
@@ -964,7 +1033,7 @@ global_repair(uip_ipaddr_t *from, rpl_dag_t *dag, rpl_dio_t *dio)
   dag->version = dio->version;
   dag->instance->of->reset(dag);
   dag->min_rank = INFINITE_RANK;
-  RPL_LOLLIPOP_INCREMENT(dag->instance->dtsn_out);
+  rpl_dtsn_increment(dag->instance);
 
   p = rpl_add_parent(dag, dio, from);
   if(p == NULL) {
@@ -1116,7 +1185,7 @@ rpl_process_dio(uip_ipaddr_t *from, rpl_dio_t *dio)
     return;
   }
 
-  if(lollipop_greater_than(dio->version, dag->version)) {
+  if(rpl_lollipop_greater_than(dio->version, dag->version)) {
     if(dag->rank == ROOT_RANK(instance)) {
       PRINTF("RPL: Root received inconsistent DIO version number\n");
       dag->version = dio->version;
@@ -1128,7 +1197,7 @@ rpl_process_dio(uip_ipaddr_t *from, rpl_dio_t *dio)
     return;
   }
 
-  if(lollipop_greater_than(dag->version, dio->version)) {
+  if(rpl_lollipop_greater_than(dag->version, dio->version)) {
     /* The DIO sender is on an older version of the DAG. */
     PRINTF("RPL: old version received => inconsistency detected\n");
     if(dag->joined) {
@@ -1213,7 +1282,7 @@ rpl_process_dio(uip_ipaddr_t *from, rpl_dio_t *dio)
   /* We don't use route control, so we can have only one official parent. */
   if(dag->joined && p == dag->preferred_parent) {
     if(should_send_dao(instance, dio, p)) {
-      RPL_LOLLIPOP_INCREMENT(instance->dtsn_out);
+      rpl_dtsn_increment(instance);
       rpl_schedule_dao(instance);
     }
   }
@@ -47,7 +47,9 @@
 #include "net/uip-ds6.h"
 #include "net/uip-nd6.h"
 #include "net/uip-icmp6.h"
+#include "net/uip-pkt.h"
 #include "net/rpl/rpl-private.h"
+#include "net/rpl/rpl-ns.h"
 #include "net/packetbuf.h"
 
 #include <limits.h>
@@ -67,10 +69,14 @@
 #define UIP_ICMP_BUF     ((struct uip_icmp_hdr *)&uip_buf[uip_l2_l3_hdr_len])
 #define UIP_ICMP_PAYLOAD ((unsigned char *)&uip_buf[uip_l2_l3_icmp_hdr_len])
 /*---------------------------------------------------------------------------*/
-static void dis_input(void);
-static void dio_input(void);
-static void dao_input(void);
-static void dao_ack_input(void);
+static void dis_input(rpl_icmp6_ctx_t *ctx);
+static void dio_input(rpl_icmp6_ctx_t *ctx);
+static void dao_input(rpl_icmp6_ctx_t *ctx);
+static void dao_ack_input(rpl_icmp6_ctx_t *ctx);
+static void dio_send(struct uip_pkt *out, rpl_instance_t *instance,
+                     uip_ipaddr_t *uc_addr);
+static void dao_ack_send(struct uip_pkt *out, rpl_instance_t *instance,
+                         uip_ipaddr_t *dest, uint8_t sequence);
 
 /* some debug callbacks useful when debugging RPL networks */
 #ifdef RPL_DEBUG_DIO_INPUT
@@ -81,15 +87,6 @@ void RPL_DEBUG_DIO_INPUT(uip_ipaddr_t *, rpl_dio_t *);
 void RPL_DEBUG_DAO_OUTPUT(rpl_parent_t *);
 #endif
 
-static uint8_t dao_sequence = RPL_LOLLIPOP_INIT;
-
-static uint8_t dao_sequence;
-static uip_ipaddr_t addr;
-static uip_ipaddr_t prefix;
-static rpl_dio_t dio;
-static uip_ipaddr_t from;
-static uip_ipaddr_t dao_sender_addr;
-
 /* some debug callbacks useful when debugging RPL networks */
 #ifdef RPL_DEBUG_DIO_INPUT
 void RPL_DEBUG_DIO_INPUT(uip_ipaddr_t *, rpl_dio_t *);
@@ -121,6 +118,50 @@ get_global_addr(uip_ipaddr_t *addr)
   return 0;
 }
 /*---------------------------------------------------------------------------*/
+/*
+ * Messages are built in a packet descriptor: that of the context when
+ * answering or forwarding one, a fresh one otherwise. The packet being
+ * processed is never written to.
+ */
+static struct uip_pkt *
+out_alloc(void)
+{
+  struct uip_pkt *out;
+
+  out = uip_pkt_alloc();
+  if(out == NULL) {
+    RPL_STAT(rpl_stats.mem_overflows++);
+    PRINTF("RPL: No packet descriptor to send a message\n");
+  }
+  return out;
+}
+/*---------------------------------------------------------------------------*/
+static unsigned char *
+out_payload(struct uip_pkt *out)
+{
+  return &out->buf.u8[UIP_LLH_LEN + UIP_IPH_LEN + UIP_ICMPH_LEN];
+}
+/*---------------------------------------------------------------------------*/
+static void
+out_send(struct uip_pkt *out, uip_ipaddr_t *dest, uint8_t code, uint16_t len)
+{
+  uint8_t ext_len;
+
+  /* The message has no extension header of its own */
+  ext_len = uip_ext_len;
+  uip_ext_len = 0;
+#if UIP_CONF_BUFFER_POINTER
+  uip_pkt_enter(out);
+  uip_icmp6_send(dest, ICMP6_RPL, code, len);
+  uip_pkt_leave(out);
+#else /* UIP_CONF_BUFFER_POINTER */
+  /* uIP only sends from uip_buf */
+  memcpy(UIP_ICMP_PAYLOAD, out_payload(out), len);
+  uip_icmp6_send(dest, ICMP6_RPL, code, len);
+#endif /* UIP_CONF_BUFFER_POINTER */
+  uip_ext_len = ext_len;
+}
+/*---------------------------------------------------------------------------*/
 static uint32_t
 get32(uint8_t *buffer, int pos)
 {
@@ -150,30 +191,135 @@ set16(uint8_t *buffer, int pos, uint16_t value)
   buffer[pos++] = value & 0xff;
 }
 /*---------------------------------------------------------------------------*/
+/*
+ * Take a token from the bucket of a DIS source. The table is direct
+ * mapped: a new source takes over the slot of the one it collides with
+ * only once that bucket would have refilled. Until then the colliding
+ * sources share it, they must not refill each other's bucket.
+ */
+static int
+dis_allowed(rpl_instance_t *instance, uip_ipaddr_t *src)
+{
+  struct rpl_dis_source *s;
+  clock_time_t now;
+  clock_time_t interval;
+  unsigned long refill;
+
+  s = &instance->dis_sources[(src->u8[14] ^ src->u8[15]) % RPL_DIS_SOURCES];
+  now = clock_time();
+  interval = (clock_time_t)RPL_DIS_TOKEN_INTERVAL * CLOCK_SECOND;
+
+  if(!s->used ||
+     (!uip_ipaddr_cmp(&s->addr, src) &&
+      now - s->last >= (clock_time_t)RPL_DIS_BURST * interval)) {
+    uip_ipaddr_copy(&s->addr, src);
+    s->used = 1;
+    s->tokens = RPL_DIS_BURST;
+    s->last = now;
+  } else {
+    refill = (now - s->last) / interval;
+    if(refill > 0) {
+      s->last += refill * interval;
+      s->tokens = refill >= RPL_DIS_BURST - s->tokens ?
+        RPL_DIS_BURST : s->tokens + refill;
+    }
+  }
+
+  if(s->tokens == 0) {
+    return 0;
+  }
+  s->tokens--;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* Answer the unicast DIS an instance gathered during the reply delay */
+static void
+dis_flush(void *ptr)
+{
+  rpl_instance_t *instance;
+  struct uip_pkt *out;
+  int i;
+
+  instance = ptr;
+  if(instance->current_dag != NULL && (out = out_alloc()) != NULL) {
+#if !RPL_LEAF_ONLY
+    /* A paced repair holds multicast DIOs, answer one by one */
+    if((instance->dis_overflow ||
+        instance->dis_npending >= RPL_DIS_COALESCE) &&
+       !instance->repair_active) {
+      PRINTF("RPL: Answering %u DIS with a multicast DIO\n",
+             (unsigned)instance->dis_npending);
+      dio_send(out, instance, NULL);
+    } else
+#endif /* !RPL_LEAF_ONLY */
+    for(i = 0; i < instance->dis_npending; i++) {
+      dio_send(out, instance, &instance->dis_pending[i]);
+    }
+    uip_pkt_free(out);
+  }
+  instance->dis_npending = 0;
+  instance->dis_overflow = 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+dis_reply(rpl_instance_t *instance, uip_ipaddr_t *src)
+{
+  int i;
+
+  for(i = 0; i < instance->dis_npending; i++) {
+    if(uip_ipaddr_cmp(&instance->dis_pending[i], src)) {
+      return;
+    }
+  }
+  if(instance->dis_npending < RPL_DIS_PENDING) {
+    uip_ipaddr_copy(&instance->dis_pending[instance->dis_npending++], src);
+  } else {
+    instance->dis_overflow = 1;
+  }
+  if(ctimer_expired(&instance->dis_timer)) {
+    ctimer_set(&instance->dis_timer, RPL_DIS_REPLY_DELAY, dis_flush, instance);
+  }
+}
+/*---------------------------------------------------------------------------*/
 static void
-dis_input(void)
+dis_input(rpl_icmp6_ctx_t *ctx)
 {
   rpl_instance_t *instance;
   rpl_instance_t *end;
 
   /* DAG Information Solicitation */
   PRINTF("RPL: Received a DIS from ");
-  PRINT6ADDR(&UIP_IP_BUF->srcipaddr);
+  PRINT6ADDR(&ctx->src);
   PRINTF("\n");
 
+  /* Each instance answers the DIS heard on its own link */
   for(instance = &instance_table[0], end = instance + RPL_MAX_INSTANCES; instance < end; ++instance) {
-    if(instance->used == 1) {
+    if(instance->used != 1 || instance->link != ctx->link) {
+      continue;
+    }
+    if(instance->dis_rx < 0xffff) {
+      instance->dis_rx++;
+    }
+
+    if(!dis_allowed(instance, &ctx->src)) {
+      PRINTF("RPL: DIS rate exceeded, ignored\n");
+      continue;
+    }
+
 #if RPL_LEAF_ONLY
-      if(!uip_is_addr_mcast(&UIP_IP_BUF->destipaddr)) {
+    if(!uip_is_addr_mcast(&ctx->dst)) {
 #else /* !RPL_LEAF_ONLY */
-      if(uip_is_addr_mcast(&UIP_IP_BUF->destipaddr)) {
+    if(uip_is_addr_mcast(&ctx->dst)) {
+      if(timer_expired(&instance->dis_reset_timer)) {
         PRINTF("RPL: Multicast DIS => reset DIO timer\n");
         rpl_reset_dio_timer(instance);
-      } else {
-#endif /* !RPL_LEAF_ONLY */
-        PRINTF("RPL: Unicast DIS, reply to sender\n");
-        dio_output(instance, &UIP_IP_BUF->srcipaddr);
+        timer_set(&instance->dis_reset_timer,
+                  (clock_time_t)RPL_DIS_RESET_MIN_INTERVAL * CLOCK_SECOND);
       }
+    } else {
+#endif /* !RPL_LEAF_ONLY */
+      PRINTF("RPL: Unicast DIS, reply to sender\n");
+      dis_reply(instance, &ctx->src);
     }
   }
 }
@@ -181,8 +327,9 @@ dis_input(void)
 void
 dis_output(uip_ipaddr_t *addr)
 {
+  struct uip_pkt *out;
   unsigned char *buffer;
-  static uip_ipaddr_t tmpaddr;
+  uip_ipaddr_t tmpaddr;
 
   /* DAG Information Solicitation  - 2 bytes reserved      */
   /*      0                   1                   2        */
@@ -191,7 +338,11 @@ dis_output(uip_ipaddr_t *addr)
   /*     |     Flags     |   Reserved    |   Option(s)...  */
   /*     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+ */
 
-  buffer = UIP_ICMP_PAYLOAD;
+  out = out_alloc();
+  if(out == NULL) {
+    return;
+  }
+  buffer = out_payload(out);
   buffer[0] = buffer[1] = 0;
 
   if(addr == NULL) {
@@ -203,18 +354,21 @@ dis_output(uip_ipaddr_t *addr)
   PRINT6ADDR(addr);
   PRINTF("\n");
 
-  uip_icmp6_send(addr, ICMP6_RPL, RPL_CODE_DIS, 2);
+  out_send(out, addr, RPL_CODE_DIS, 2);
+  uip_pkt_free(out);
 }
 /*---------------------------------------------------------------------------*/
 static void
-dio_input(void)
+dio_input(rpl_icmp6_ctx_t *ctx)
 {
   unsigned char *buffer;
-  uint8_t buffer_length;
+  uint16_t buffer_length;
   uint8_t subopt_type;
   int i;
   int len;
   uip_ds6_nbr_t *nbr;
+  rpl_instance_t *instance;
+  rpl_dio_t dio;
 
   memset(&dio, 0, sizeof(dio));
 
@@ -228,34 +382,37 @@ dio_input(void)
   dio.default_lifetime = RPL_DEFAULT_LIFETIME;
   dio.lifetime_unit = RPL_DEFAULT_LIFETIME_UNIT;
 
-  uip_ipaddr_copy(&from, &UIP_IP_BUF->srcipaddr);
-
   /* DAG Information Object */
   PRINTF("RPL: Received a DIO from ");
-  PRINT6ADDR(&from);
+  PRINT6ADDR(&ctx->src);
   PRINTF("\n");
 
-  if((nbr = uip_ds6_nbr_lookup(&from)) == NULL) {
-    if((nbr = uip_ds6_nbr_add(&from, (uip_lladdr_t *)
-                              packetbuf_addr(PACKETBUF_ADDR_SENDER),
+  if((nbr = uip_ds6_nbr_lookup(&ctx->src)) == NULL) {
+    if((nbr = uip_ds6_nbr_add(&ctx->src, ctx->lladdr,
                               0, NBR_REACHABLE)) != NULL) {
       /* set reachable timer */
       stimer_set(&nbr->reachable, UIP_ND6_REACHABLE_TIME / 1000);
+      uip_ds6_nbr_schedule(nbr);
       PRINTF("RPL: Neighbor added to neighbor cache ");
-      PRINT6ADDR(&from);
+      PRINT6ADDR(&ctx->src);
       PRINTF(", ");
-      PRINTLLADDR((uip_lladdr_t *)packetbuf_addr(PACKETBUF_ADDR_SENDER));
+      PRINTLLADDR(ctx->lladdr);
       PRINTF("\n");
     }
   } else {
     PRINTF("RPL: Neighbor already in neighbor cache\n");
   }
 
-  buffer_length = uip_len - uip_l3_icmp_hdr_len;
+  buffer = ctx->buffer;
+  buffer_length = ctx->len;
+  if(buffer_length < 8 + sizeof(dio.dag_id)) {
+    PRINTF("RPL: Truncated DIO\n");
+    RPL_STAT(rpl_stats.malformed_msgs++);
+    return;
+  }
 
   /* Process the DIO base option. */
   i = 0;
-  buffer = UIP_ICMP_PAYLOAD;
 
   dio.instance_id = buffer[i++];
   dio.version = buffer[i++];
@@ -400,31 +557,32 @@ dio_input(void)
   }
 
 #ifdef RPL_DEBUG_DIO_INPUT
-  RPL_DEBUG_DIO_INPUT(&from, &dio);
+  RPL_DEBUG_DIO_INPUT(&ctx->src, &dio);
 #endif
 
-  rpl_process_dio(&from, &dio);
+  instance = rpl_get_instance(dio.instance_id);
+  if(instance != NULL && instance->link != ctx->link) {
+    PRINTF("RPL: Ignoring a DIO for instance %u from another link\n",
+           (unsigned)dio.instance_id);
+    return;
+  }
+
+  rpl_process_dio(&ctx->src, &dio);
 }
 /*---------------------------------------------------------------------------*/
-void
-dio_output(rpl_instance_t *instance, uip_ipaddr_t *uc_addr)
+/*
+ * Serialize the DIO of an instance. Returns its length, 0 when it
+ * cannot be built.
+ */
+static int
+dio_build(rpl_instance_t *instance, unsigned char *buffer)
 {
-  unsigned char *buffer;
-  static int pos;
+  int pos;
   rpl_dag_t *dag = instance->current_dag;
 
-#if RPL_LEAF_ONLY
-  /* In leaf mode, we send DIO message only as unicasts in response to 
-     unicast DIS messages. */
-  if(uc_addr == NULL) {
-    return;
-  }
-#endif /* RPL_LEAF_ONLY */
-
   /* DAG Information Object */
   pos = 0;
 
-  buffer = UIP_ICMP_PAYLOAD;
   buffer[pos++] = instance->instance_id;
   buffer[pos++] = dag->version;
 
@@ -446,9 +604,6 @@ dio_output(rpl_instance_t *instance, uip_ipaddr_t *uc_addr)
 
   buffer[pos++] = instance->dtsn_out;
 
-  /* always request new DAO to refresh route */
-  RPL_LOLLIPOP_INCREMENT(instance->dtsn_out);
-
   /* reserved 2 bytes */
   buffer[pos++] = 0; /* flags */
   buffer[pos++] = 0; /* reserved */
@@ -477,7 +632,7 @@ dio_output(rpl_instance_t *instance, uip_ipaddr_t *uc_addr)
     } else {
       PRINTF("RPL: Unable to send DIO because of unhandled DAG MC type %u\n",
 	(unsigned)instance->mc.type);
-      return;
+      return 0;
     }
   }
 #endif /* !RPL_LEAF_ONLY */
@@ -523,62 +678,186 @@ dio_output(rpl_instance_t *instance, uip_ipaddr_t *uc_addr)
            dag->prefix_info.length);
   }
 
+  return pos;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Drop the cached DIO. Called whenever the instance, its current DAG or
+ * the prefix it announces changes; rank, version and DTSN are patched
+ * on every send and need no invalidation.
+ */
+void
+rpl_dio_invalidate(rpl_instance_t *instance)
+{
+  instance->dio_cache_len = 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+dio_send(struct uip_pkt *out, rpl_instance_t *instance, uip_ipaddr_t *uc_addr)
+{
+  unsigned char *buffer;
+  uip_ipaddr_t addr;
+  int pos;
+  rpl_dag_t *dag = instance->current_dag;
+
+#if RPL_LEAF_ONLY
+  /* In leaf mode, we send DIO message only as unicasts in response to 
+     unicast DIS messages. */
+  if(uc_addr == NULL) {
+    return;
+  }
+#endif /* RPL_LEAF_ONLY */
+
+  /* Whatever the caller, a DIO goes out on the link of its instance */
+  uip_ds6_set_link(instance->link);
+
+  /* The metric container follows the rank, rebuild it when that moves */
+  if(instance->dio_cache_len == 0 ||
+     (instance->mc.type != RPL_DAG_MC_NONE &&
+      instance->dio_cache_rank != dag->rank)) {
+    pos = dio_build(instance, instance->dio_cache);
+    if(pos == 0) {
+      return;
+    }
+    instance->dio_cache_len = pos;
+    instance->dio_cache_rank = dag->rank;
+  }
+
+  pos = instance->dio_cache_len;
+  buffer = out_payload(out);
+  memcpy(buffer, instance->dio_cache, pos);
+
+  /* Patch the fields that change between sends */
+  buffer[1] = dag->version;
+#if !RPL_LEAF_ONLY
+  set16(buffer, 2, dag->rank);
+#endif /* !RPL_LEAF_ONLY */
+  buffer[5] = instance->dtsn_out;
+
+#if RPL_DTSN_POLICY == RPL_DTSN_ALWAYS
+  /* always request new DAO to refresh route */
+  rpl_dtsn_increment(instance);
+#endif /* RPL_DTSN_POLICY == RPL_DTSN_ALWAYS */
+
 #if RPL_LEAF_ONLY
   PRINTF("RPL: Sending unicast-DIO with rank %u to ",
       (unsigned)dag->rank);
   PRINT6ADDR(uc_addr);
   PRINTF("\n");
-  uip_icmp6_send(uc_addr, ICMP6_RPL, RPL_CODE_DIO, pos);
+  out_send(out, uc_addr, RPL_CODE_DIO, pos);
 #else /* RPL_LEAF_ONLY */
   /* Unicast requests get unicast replies! */
   if(uc_addr == NULL) {
     PRINTF("RPL: Sending a multicast-DIO with rank %u\n",
         (unsigned)instance->current_dag->rank);
     uip_create_linklocal_rplnodes_mcast(&addr);
-    uip_icmp6_send(&addr, ICMP6_RPL, RPL_CODE_DIO, pos);
+    out_send(out, &addr, RPL_CODE_DIO, pos);
   } else {
     PRINTF("RPL: Sending unicast-DIO with rank %u to ",
         (unsigned)instance->current_dag->rank);
     PRINT6ADDR(uc_addr);
     PRINTF("\n");
-    uip_icmp6_send(uc_addr, ICMP6_RPL, RPL_CODE_DIO, pos);
+    out_send(out, uc_addr, RPL_CODE_DIO, pos);
   }
 #endif /* RPL_LEAF_ONLY */
 }
 /*---------------------------------------------------------------------------*/
+void
+dio_output(rpl_instance_t *instance, uip_ipaddr_t *uc_addr)
+{
+  struct uip_pkt *out;
+
+  out = out_alloc();
+  if(out != NULL) {
+    dio_send(out, instance, uc_addr);
+    uip_pkt_free(out);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * In non-storing mode only the root takes DAOs, addressed to it by the
+ * targets themselves. Each transit parent becomes a link of the graph
+ * source routes are computed from; nothing is forwarded.
+ */
 static void
-dao_input(void)
+dao_input_nonstoring(rpl_dag_t *dag, rpl_dao_target_t *targets, int ntargets)
+{
+  rpl_dao_target_t *t;
+  rpl_ns_node_t *node;
+
+  if(dag->rank != ROOT_RANK(dag->instance)) {
+    PRINTF("RPL: Ignoring a non-storing DAO, we are not the root\n");
+    return;
+  }
+
+  for(t = targets; t < &targets[ntargets]; t++) {
+    node = rpl_ns_get_node(dag, &t->prefix);
+    if(node != NULL && !node->stale &&
+       rpl_lollipop_greater_than(node->path_sequence, t->path_sequence)) {
+      PRINTF("RPL: Stale non-storing DAO target ");
+      PRINT6ADDR(&t->prefix);
+      PRINTF("\n");
+      continue;
+    }
+    if(t->lifetime == RPL_ZERO_LIFETIME) {
+      /* No-Path DAO, let the link expire */
+      if(node != NULL && rpl_ns_lifetime(node) > DAO_EXPIRATION_TIMEOUT &&
+         rpl_ns_lifetime(node) != RPL_NS_INFINITE_LIFETIME) {
+        rpl_ns_set_lifetime(node, DAO_EXPIRATION_TIMEOUT);
+        node->path_sequence = t->path_sequence;
+      }
+      continue;
+    }
+    if(!t->has_parent) {
+      PRINTF("RPL: Non-storing DAO target without a parent\n");
+      continue;
+    }
+    if(rpl_ns_update_node(dag, &t->prefix, &t->parent,
+                          RPL_LIFETIME(dag->instance, t->lifetime),
+                          t->path_sequence) == NULL) {
+      RPL_STAT(rpl_stats.mem_overflows++);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+dao_input(rpl_icmp6_ctx_t *ctx)
 {
   rpl_dag_t *dag;
   rpl_instance_t *instance;
   unsigned char *buffer;
-  static uint16_t sequence;
-  static uint8_t instance_id;
-  static uint8_t lifetime;
-  static uint8_t prefixlen;
+  uint8_t sequence;
+  uint8_t instance_id;
+  rpl_dao_target_t targets[RPL_DAO_MAX_TARGETS];
+  int ntargets;
   uint8_t flags;
   uint8_t subopt_type;
-  uint8_t pathcontrol;
-  uint8_t pathsequence;
   uip_ds6_route_t *rep;
-  static uint8_t buffer_length;
-  static int pos;
+  rpl_dao_target_t *t;
+  uint16_t buffer_length;
+  int pos;
   int len;
   int i;
+  int group;
+  int advertised;
+  int fresh;
   int learned_from;
   rpl_parent_t *p;
 
-  prefixlen = 0;
-
-  uip_ipaddr_copy(&dao_sender_addr, &UIP_IP_BUF->srcipaddr);
+  ntargets = 0;
 
   /* Destination Advertisement Object */
   PRINTF("RPL: Received a DAO from ");
-  PRINT6ADDR(&dao_sender_addr);
+  PRINT6ADDR(&ctx->src);
   PRINTF("\n");
 
-  buffer = UIP_ICMP_PAYLOAD;
-  buffer_length = uip_len - uip_l3_icmp_hdr_len;
+  buffer = ctx->buffer;
+  buffer_length = ctx->len;
+  if(buffer_length < 4) {
+    PRINTF("RPL: Truncated DAO\n");
+    RPL_STAT(rpl_stats.malformed_msgs++);
+    return;
+  }
 
   pos = 0;
   instance_id = buffer[pos++];
@@ -589,8 +868,18 @@ dao_input(void)
            instance_id);
     return;
   }
+  if(instance->link != ctx->link) {
+    PRINTF("RPL: Ignoring a DAO for instance %u from another link\n",
+           instance_id);
+    return;
+  }
 
-  lifetime = instance->default_lifetime;
+  if(instance->dao_rx < 0xffff) {
+    instance->dao_rx++;
+  }
+  if(instance->repair_dao < 0xffff) {
+    instance->repair_dao++;
+  }
 
   flags = buffer[pos++];
   /* reserved */
@@ -600,7 +889,8 @@ dao_input(void)
   dag = instance->current_dag;
   /* Is the DAGID present? */
   if(flags & RPL_DAO_D_FLAG) {
-    if(memcmp(&dag->dag_id, &buffer[pos], sizeof(dag->dag_id))) {
+    if(pos + sizeof(dag->dag_id) > buffer_length ||
+       memcmp(&dag->dag_id, &buffer[pos], sizeof(dag->dag_id))) {
       PRINTF("RPL: Ignoring a DAO for a DAG different from ours\n");
       return;
     }
@@ -609,7 +899,13 @@ dao_input(void)
     /* Perhaps, there are verification to do but ... */
   }
 
-  /* Check if there are any RPL options present. */
+  /*
+   * Collect every target. A transit option applies to the targets
+   * listed since the previous transit option; targets without one
+   * keep the default lifetime.
+   */
+  group = 0;
+  advertised = 0;
   i = pos;
   for(; i < buffer_length; i += len) {
     subopt_type = buffer[i];
@@ -619,49 +915,81 @@ dao_input(void)
       /* The option consists of a two-byte header and a payload. */
       len = 2 + buffer[i + 1];
     }
+    if(i + len > buffer_length) {
+      PRINTF("RPL: Truncated DAO option %u\n", subopt_type);
+      break;
+    }
 
     switch(subopt_type) {
     case RPL_OPTION_TARGET:
       /* Handle the target option. */
-      prefixlen = buffer[i + 3];
-      memset(&prefix, 0, sizeof(prefix));
-      memcpy(&prefix, buffer + i + 4, (prefixlen + 7) / CHAR_BIT);
+      if(len < 4 || buffer[i + 3] > 128 ||
+         4 + (buffer[i + 3] + 7) / CHAR_BIT > len) {
+        PRINTF("RPL: Invalid DAO target option, len = %d\n", len);
+        break;
+      }
+      if(ntargets == RPL_DAO_MAX_TARGETS) {
+        PRINTF("RPL: Too many targets in a DAO, dropping one\n");
+        break;
+      }
+      t = &targets[ntargets++];
+      t->length = buffer[i + 3];
+      memset(&t->prefix, 0, sizeof(t->prefix));
+      memcpy(&t->prefix, buffer + i + 4, (t->length + 7) / CHAR_BIT);
+      t->lifetime = instance->default_lifetime;
+      t->path_control = 0;
+      t->path_sequence = 0;
+      t->has_parent = 0;
       break;
     case RPL_OPTION_TRANSIT:
-      /* The path sequence and control are ignored. */
-      pathcontrol = buffer[i + 3];
-      pathsequence = buffer[i + 4];
-      lifetime = buffer[i + 5];
-      /* The parent address is also ignored. */
+      if(len < 6) {
+        PRINTF("RPL: Invalid DAO transit option, len = %d\n", len);
+        break;
+      }
+      for(t = &targets[group]; t < &targets[ntargets]; t++) {
+        t->path_control = buffer[i + 3];
+        t->path_sequence = buffer[i + 4];
+        t->lifetime = buffer[i + 5];
+        /* The parent address is only present in non-storing mode */
+        if(len >= 6 + 16) {
+          memcpy(&t->parent, buffer + i + 6, sizeof(t->parent));
+          t->has_parent = 1;
+        }
+      }
+      group = ntargets;
       break;
     }
   }
 
-  PRINTF("RPL: DAO lifetime: %u, prefix length: %u prefix: ",
-          (unsigned)lifetime, (unsigned)prefixlen);
-  PRINT6ADDR(&prefix);
-  PRINTF("\n");
+  if(ntargets == 0) {
+    PRINTF("RPL: DAO without a target\n");
+    return;
+  }
 
-  rep = uip_ds6_route_lookup(&prefix);
+  for(t = targets; t < &targets[ntargets]; t++) {
+    PRINTF("RPL: DAO lifetime: %u, prefix length: %u prefix: ",
+           (unsigned)t->lifetime, (unsigned)t->length);
+    PRINT6ADDR(&t->prefix);
+    PRINTF("\n");
+    if(t->lifetime != RPL_ZERO_LIFETIME) {
+      advertised++;
+    }
+  }
 
-  if(lifetime == RPL_ZERO_LIFETIME) {
-    /* No-Path DAO received; invoke the route purging routine. */
-    if(rep != NULL && rep->state.saved_lifetime == 0 && rep->length == prefixlen) {
-      PRINTF("RPL: Setting expiration timer for prefix ");
-      PRINT6ADDR(&prefix);
-      PRINTF("\n");
-      rep->state.saved_lifetime = rep->state.lifetime;
-      rep->state.lifetime = DAO_EXPIRATION_TIMEOUT;
+  if(instance->mop == RPL_MOP_NON_STORING) {
+    dao_input_nonstoring(dag, targets, ntargets);
+    if(flags & RPL_DAO_K_FLAG) {
+      dao_ack_send(ctx->out, instance, &ctx->src, sequence);
     }
     return;
   }
 
-  learned_from = uip_is_addr_mcast(&dao_sender_addr) ?
+  learned_from = uip_is_addr_mcast(&ctx->src) ?
                  RPL_ROUTE_FROM_MULTICAST_DAO : RPL_ROUTE_FROM_UNICAST_DAO;
 
-  if(learned_from == RPL_ROUTE_FROM_UNICAST_DAO) {
+  if(advertised > 0 && learned_from == RPL_ROUTE_FROM_UNICAST_DAO) {
     /* Check whether this is a DAO forwarding loop. */
-    p = rpl_find_parent(dag, &dao_sender_addr);
+    p = rpl_find_parent(dag, &ctx->src);
     /* check if this is a new DAO registration with an "illegal" rank */
     /* if we already route to this node it is likely */
     if(p != NULL && DAG_RANK(p->rank, instance) < DAG_RANK(dag->rank, instance)) {
@@ -673,26 +1001,53 @@ dao_input(void)
     }
   }
 
-  rep = rpl_add_route(dag, &prefix, prefixlen, &dao_sender_addr);
-  if(rep == NULL) {
+  if(rpl_add_routes(dag, targets, ntargets, &ctx->src, learned_from) > 0) {
     RPL_STAT(rpl_stats.mem_overflows++);
-    PRINTF("RPL: Could not add a route after receiving a DAO\n");
-    return;
+    PRINTF("RPL: Could not add all routes after receiving a DAO\n");
+  }
+
+  fresh = 0;
+  for(t = targets; t < &targets[ntargets]; t++) {
+    rep = t->route;
+    if(t->stale) {
+      continue;
+    }
+    fresh++;
+    if(t->lifetime == RPL_ZERO_LIFETIME) {
+      /* No-Path DAO received; invoke the route purging routine. */
+      if(rep != NULL && rep->state.saved_lifetime == 0) {
+        PRINTF("RPL: Setting expiration timer for prefix ");
+        PRINT6ADDR(&t->prefix);
+        PRINTF("\n");
+        rep->state.saved_lifetime = rpl_route_lifetime(rep);
+        rpl_route_set_lifetime(rep, DAO_EXPIRATION_TIMEOUT);
+        rep->state.path_sequence = t->path_sequence;
+      }
+    }
   }
 
-  rep->state.lifetime = RPL_LIFETIME(instance, lifetime);
-  rep->state.learned_from = learned_from;
+  /* Nothing new for our parent if every target was stale or withdrawn */
+  if(fresh == 0 || advertised == 0) {
+    PRINTF("RPL: Nothing to forward from this DAO\n");
+    return;
+  }
 
   if(learned_from == RPL_ROUTE_FROM_UNICAST_DAO) {
     if(dag->preferred_parent) {
       PRINTF("RPL: Forwarding DAO to parent ");
       PRINT6ADDR(&dag->preferred_parent->addr);
       PRINTF("\n");
-      uip_icmp6_send(&dag->preferred_parent->addr,
-                     ICMP6_RPL, RPL_CODE_DAO, buffer_length);
+      if(ctx->out == NULL) {
+        RPL_STAT(rpl_stats.mem_overflows++);
+        PRINTF("RPL: No packet descriptor to forward the DAO\n");
+      } else {
+        memcpy(out_payload(ctx->out), ctx->buffer, buffer_length);
+        out_send(ctx->out, &dag->preferred_parent->addr,
+                 RPL_CODE_DAO, buffer_length);
+      }
     }
     if(flags & RPL_DAO_K_FLAG) {
-      dao_ack_output(instance, &dao_sender_addr, sequence);
+      dao_ack_send(ctx->out, instance, &ctx->src, sequence);
     }
   }
 }
@@ -702,7 +1057,9 @@ dao_output(rpl_parent_t *n, uint8_t lifetime)
 {
   rpl_dag_t *dag;
   rpl_instance_t *instance;
+  struct uip_pkt *out;
   unsigned char *buffer;
+  uip_ipaddr_t prefix;
   uint8_t prefixlen;
   int pos;
 
@@ -715,14 +1072,19 @@ dao_output(rpl_parent_t *n, uint8_t lifetime)
 
   dag = n->dag;
   instance = dag->instance;
+  uip_ds6_set_link(instance->link);
 
 #ifdef RPL_DEBUG_DAO_OUTPUT
   RPL_DEBUG_DAO_OUTPUT(n);
 #endif
 
-  buffer = UIP_ICMP_PAYLOAD;
+  out = out_alloc();
+  if(out == NULL) {
+    return;
+  }
+  buffer = out_payload(out);
 
-  RPL_LOLLIPOP_INCREMENT(dao_sequence);
+  RPL_LOLLIPOP_INCREMENT(instance->dao_sequence);
   pos = 0;
 
   buffer[pos++] = instance->instance_id;
@@ -735,7 +1097,7 @@ dao_output(rpl_parent_t *n, uint8_t lifetime)
 #endif /* RPL_CONF_DAO_ACK */
   ++pos;
   buffer[pos++] = 0; /* reserved */
-  buffer[pos++] = dao_sequence;
+  buffer[pos++] = instance->dao_sequence;
 #if RPL_DAO_SPECIFY_DAG
   memcpy(buffer + pos, &dag->dag_id, sizeof(dag->dag_id));
   pos+=sizeof(dag->dag_id);
@@ -764,20 +1126,24 @@ dao_output(rpl_parent_t *n, uint8_t lifetime)
   PRINT6ADDR(&n->addr);
   PRINTF("\n");
 
-  uip_icmp6_send(&n->addr, ICMP6_RPL, RPL_CODE_DAO, pos);
+  out_send(out, &n->addr, RPL_CODE_DAO, pos);
+  uip_pkt_free(out);
 }
 /*---------------------------------------------------------------------------*/
 static void
-dao_ack_input(void)
+dao_ack_input(rpl_icmp6_ctx_t *ctx)
 {
   unsigned char *buffer;
-  uint8_t buffer_length;
   uint8_t instance_id;
   uint8_t sequence;
   uint8_t status;
 
-  buffer = UIP_ICMP_PAYLOAD;
-  buffer_length = uip_len - uip_l3_icmp_hdr_len;
+  buffer = ctx->buffer;
+  if(ctx->len < 4) {
+    PRINTF("RPL: Truncated DAO ACK\n");
+    RPL_STAT(rpl_stats.malformed_msgs++);
+    return;
+  }
 
   instance_id = buffer[0];
   sequence = buffer[2];
@@ -785,50 +1151,77 @@ dao_ack_input(void)
 
   PRINTF("RPL: Received a DAO ACK with sequence number %d and status %d from ",
     sequence, status);
-  PRINT6ADDR(&UIP_IP_BUF->srcipaddr);
+  PRINT6ADDR(&ctx->src);
   PRINTF("\n");
 }
 /*---------------------------------------------------------------------------*/
-void
-dao_ack_output(rpl_instance_t *instance, uip_ipaddr_t *dest, uint8_t sequence)
+static void
+dao_ack_send(struct uip_pkt *out, rpl_instance_t *instance,
+             uip_ipaddr_t *dest, uint8_t sequence)
 {
   unsigned char *buffer;
 
+  if(out == NULL) {
+    RPL_STAT(rpl_stats.mem_overflows++);
+    PRINTF("RPL: No packet descriptor to send a DAO ACK\n");
+    return;
+  }
+
   PRINTF("RPL: Sending a DAO ACK with sequence number %d to ", sequence);
   PRINT6ADDR(dest);
   PRINTF("\n");
 
-  buffer = UIP_ICMP_PAYLOAD;
+  buffer = out_payload(out);
 
   buffer[0] = instance->instance_id;
   buffer[1] = 0;
   buffer[2] = sequence;
   buffer[3] = 0;
 
-  uip_icmp6_send(dest, ICMP6_RPL, RPL_CODE_DAO_ACK, 4);
+  out_send(out, dest, RPL_CODE_DAO_ACK, 4);
 }
 /*---------------------------------------------------------------------------*/
 void
-uip_rpl_input(void)
+rpl_icmp6_input(rpl_icmp6_ctx_t *ctx)
 {
   PRINTF("Received an RPL control message\n");
-  switch(UIP_ICMP_BUF->icode) {
+  uip_ds6_set_link(ctx->link);
+  switch(ctx->code) {
   case RPL_CODE_DIO:
-    dio_input();
+    dio_input(ctx);
     break;
   case RPL_CODE_DIS:
-    dis_input();
+    dis_input(ctx);
     break;
   case RPL_CODE_DAO:
-    dao_input();
+    dao_input(ctx);
     break;
   case RPL_CODE_DAO_ACK:
-    dao_ack_input();
+    dao_ack_input(ctx);
     break;
   default:
-    PRINTF("RPL: received an unknown ICMP6 code (%u)\n", UIP_ICMP_BUF->icode);
+    PRINTF("RPL: received an unknown ICMP6 code (%u)\n", ctx->code);
     break;
   }
+}
+/*---------------------------------------------------------------------------*/
+void
+uip_rpl_input(void)
+{
+  rpl_icmp6_ctx_t ctx;
+
+  uip_ipaddr_copy(&ctx.src, &UIP_IP_BUF->srcipaddr);
+  uip_ipaddr_copy(&ctx.dst, &UIP_IP_BUF->destipaddr);
+  ctx.buffer = UIP_ICMP_PAYLOAD;
+  ctx.len = uip_len - uip_l3_icmp_hdr_len;
+  ctx.code = UIP_ICMP_BUF->icode;
+  ctx.link = uip_ds6_link;
+  ctx.lladdr = (uip_lladdr_t *)packetbuf_addr(PACKETBUF_ADDR_SENDER);
+  ctx.out = uip_pkt_alloc();
+
+  rpl_icmp6_input(&ctx);
+
+  uip_pkt_free(ctx.out);
 
   uip_len = 0;
 }
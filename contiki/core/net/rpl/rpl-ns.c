@@ -0,0 +1,423 @@
+/**
+ * \addtogroup uip6
+ * @{
+ */
+
+/**
+ * \file
+ *         RPL non-storing mode: the DAO parent graph kept by the root
+ */
+
+#include <string.h>
+
+#include "net/uip.h"
+#include "net/uip-ds6.h"
+#include "net/rpl/rpl-private.h"
+#include "net/rpl/rpl-ns.h"
+
+#include "lib/list.h"
+#include "lib/memb.h"
+#include "lib/heap.h"
+
+#include <stddef.h>
+
+#define DEBUG DEBUG_NONE
+#include "net/uip-debug.h"
+
+MEMB(ns_memb, rpl_ns_node_t, RPL_NS_LINK_NUM);
+LIST(ns_list);
+HEAP(ns_heap, RPL_NS_LINK_NUM);
+static int num_nodes;
+/*
+ * Every node, chained by address hash, so that a DAO finds its target
+ * and transit parent without walking the graph. Each node also chains
+ * its children, for the changes below it to be found the same way.
+ */
+static rpl_ns_node_t *ns_hash[RPL_NS_HASH_SIZE];
+
+#define node_of(n) \
+  ((rpl_ns_node_t *)((char *)(n) - offsetof(rpl_ns_node_t, expiry)))
+
+#define node_slot(n) ((n) - (rpl_ns_node_t *)ns_memb.mem)
+
+/*---------------------------------------------------------------------------*/
+static rpl_ns_node_t **
+node_bucket(uip_ipaddr_t *addr)
+{
+  return &ns_hash[(addr->u8[12] ^ addr->u8[13] ^
+                   addr->u8[14] ^ addr->u8[15]) &
+                  (RPL_NS_HASH_SIZE - 1)];
+}
+/*---------------------------------------------------------------------------*/
+static void
+node_hash_remove(rpl_ns_node_t *node)
+{
+  rpl_ns_node_t **pp;
+
+  for(pp = node_bucket(&node->addr); *pp != NULL; pp = &(*pp)->hash_next) {
+    if(*pp == node) {
+      *pp = node->hash_next;
+      return;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Move node below parent, NULL to leave it without one */
+static void
+set_parent(rpl_ns_node_t *node, rpl_ns_node_t *parent)
+{
+  if(node->parent != NULL) {
+    if(node->sibling_prev != NULL) {
+      node->sibling_prev->sibling = node->sibling;
+    } else {
+      node->parent->children = node->sibling;
+    }
+    if(node->sibling != NULL) {
+      node->sibling->sibling_prev = node->sibling_prev;
+    }
+  }
+  node->parent = parent;
+  node->sibling_prev = NULL;
+  node->sibling = NULL;
+  if(parent != NULL) {
+    node->sibling = parent->children;
+    if(parent->children != NULL) {
+      parent->children->sibling_prev = node;
+    }
+    parent->children = node;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+is_root(rpl_ns_node_t *node)
+{
+  return node->expires == RPL_NS_INFINITE_LIFETIME;
+}
+/*---------------------------------------------------------------------------*/
+uint32_t
+rpl_ns_lifetime(rpl_ns_node_t *node)
+{
+  unsigned long now;
+
+  if(is_root(node)) {
+    return RPL_NS_INFINITE_LIFETIME;
+  }
+  now = clock_seconds();
+  return node->expires > now ? node->expires - now : 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_ns_set_lifetime(rpl_ns_node_t *node, uint32_t lifetime)
+{
+  if(is_root(node)) {
+    return;
+  }
+  node->expires = clock_seconds() + lifetime;
+  heap_set(&ns_heap, &node->expiry, node->expires);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Log the source routes that go through node, node included, when its
+ * path to the root changed, walking down the child chains. The deeper
+ * nodes would exceed the longest source route anyway.
+ */
+static void
+log_subtree(rpl_ns_node_t *node)
+{
+  rpl_ns_node_t *n;
+  int depth;
+
+  n = node;
+  depth = 0;
+  while(1) {
+    uip_ds6_route_log(UIP_DS6_ROUTE_SRCRT, node_slot(n), &n->addr, 128);
+    if(n->children != NULL && depth < RPL_NS_MAX_HOPS) {
+      n = n->children;
+      depth++;
+      continue;
+    }
+    while(n != node && n->sibling == NULL) {
+      n = n->parent;
+      depth--;
+    }
+    if(n == node) {
+      return;
+    }
+    n = n->sibling;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static rpl_ns_node_t *
+add_node(rpl_dag_t *dag, uip_ipaddr_t *addr, uint32_t lifetime)
+{
+  rpl_ns_node_t *node;
+
+  node = memb_alloc(&ns_memb);
+  if(node == NULL) {
+    PRINTF("RPL: No space for more non-storing links\n");
+    return NULL;
+  }
+  node->parent = NULL;
+  node->children = NULL;
+  node->sibling = NULL;
+  node->sibling_prev = NULL;
+  node->dag = dag;
+  uip_ipaddr_copy(&node->addr, addr);
+  heap_node_init(&node->expiry);
+  if(lifetime == RPL_NS_INFINITE_LIFETIME) {
+    node->expires = RPL_NS_INFINITE_LIFETIME;
+  } else {
+    rpl_ns_set_lifetime(node, lifetime);
+  }
+  node->path_sequence = 0;
+  node->stale = 0;
+  list_add(ns_list, node);
+  node->hash_next = *node_bucket(addr);
+  *node_bucket(addr) = node;
+  num_nodes++;
+  return node;
+}
+/*---------------------------------------------------------------------------*/
+int
+rpl_ns_num_nodes(void)
+{
+  return num_nodes;
+}
+/*---------------------------------------------------------------------------*/
+rpl_ns_node_t *
+rpl_ns_get_node(rpl_dag_t *dag, uip_ipaddr_t *addr)
+{
+  rpl_ns_node_t *node;
+
+  for(node = *node_bucket(addr); node != NULL; node = node->hash_next) {
+    if(node->dag == dag && uip_ipaddr_cmp(&node->addr, addr)) {
+      return node;
+    }
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+rpl_ns_node_t *
+rpl_ns_get_slot(uint16_t slot)
+{
+  if(slot >= RPL_NS_LINK_NUM || ns_memb.count[slot] == 0) {
+    return NULL;
+  }
+  return (rpl_ns_node_t *)ns_memb.mem + slot;
+}
+/*---------------------------------------------------------------------------*/
+rpl_ns_node_t *
+rpl_ns_update_node(rpl_dag_t *dag, uip_ipaddr_t *child, uip_ipaddr_t *parent,
+                   uint32_t lifetime, uint8_t path_sequence)
+{
+  rpl_ns_node_t *child_node;
+  rpl_ns_node_t *parent_node;
+  rpl_ns_node_t *node;
+  int depth;
+
+  child_node = rpl_ns_get_node(dag, child);
+  parent_node = rpl_ns_get_node(dag, parent);
+
+  if(parent_node == NULL) {
+    if(uip_ds6_is_my_addr(parent) ||
+       uip_ipaddr_cmp(parent, &dag->dag_id)) {
+      parent_node = add_node(dag, parent, RPL_NS_INFINITE_LIFETIME);
+    } else {
+      /* Unknown until its own DAO arrives, keep it as long as the child */
+      parent_node = add_node(dag, parent, lifetime);
+    }
+    if(parent_node == NULL) {
+      return NULL;
+    }
+  }
+
+  /* Refuse a parent that reaches the root through the child */
+  if(child_node != NULL) {
+    for(node = parent_node, depth = 0;
+        node != NULL && depth < RPL_NS_LINK_NUM;
+        node = node->parent, depth++) {
+      if(node == child_node) {
+        PRINTF("RPL: Non-storing link ");
+        PRINT6ADDR(child);
+        PRINTF(" -> ");
+        PRINT6ADDR(parent);
+        PRINTF(" would loop\n");
+        return NULL;
+      }
+    }
+  }
+
+  if(child_node == NULL) {
+    child_node = add_node(dag, child, lifetime);
+    if(child_node == NULL) {
+      return NULL;
+    }
+  } else if(is_root(child_node)) {
+    return child_node;
+  }
+
+  if(child_node->parent != parent_node) {
+    set_parent(child_node, parent_node);
+    log_subtree(child_node);
+    PRINTF("RPL: Non-storing link ");
+    PRINT6ADDR(child);
+    PRINTF(" -> ");
+    PRINT6ADDR(parent);
+    PRINTF("\n");
+  }
+  rpl_ns_set_lifetime(child_node, lifetime);
+  child_node->path_sequence = path_sequence;
+  child_node->stale = 0;
+
+  /* An implicit parent lives at least as long as its children */
+  if(!is_root(parent_node) && parent_node->expires < child_node->expires) {
+    rpl_ns_set_lifetime(parent_node, lifetime);
+  }
+
+  return child_node;
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_ns_remove_node(rpl_ns_node_t *node)
+{
+  log_subtree(node);
+  while(node->children != NULL) {
+    set_parent(node->children, NULL);
+  }
+  set_parent(node, NULL);
+  node_hash_remove(node);
+  heap_remove(&ns_heap, &node->expiry);
+  list_remove(ns_list, node);
+  memb_free(&ns_memb, node);
+  num_nodes--;
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_ns_remove_nodes(rpl_dag_t *dag)
+{
+  rpl_ns_node_t *node;
+  rpl_ns_node_t *next;
+
+  for(node = list_head(ns_list); node != NULL; node = next) {
+    next = list_item_next(node);
+    if(node->dag == dag) {
+      rpl_ns_remove_node(node);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_ns_stale_nodes(rpl_dag_t *dag, uint32_t grace)
+{
+  rpl_ns_node_t *node;
+
+  for(node = list_head(ns_list); node != NULL; node = list_item_next(node)) {
+    if(node->dag == dag && !is_root(node)) {
+      node->stale = 1;
+      if(rpl_ns_lifetime(node) > grace) {
+        rpl_ns_set_lifetime(node, grace);
+      }
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_ns_move_nodes(rpl_dag_t *from, rpl_dag_t *to)
+{
+  rpl_ns_node_t *node;
+
+  for(node = list_head(ns_list); node != NULL; node = list_item_next(node)) {
+    if(node->dag == from) {
+      node->dag = to;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+rpl_ns_get_path(rpl_ns_node_t *node, uip_ipaddr_t *hops, int max)
+{
+  rpl_ns_node_t *p;
+  uip_ipaddr_t tmp;
+  int n;
+  int i;
+
+  if(is_root(node)) {
+    return -1;
+  }
+
+  /* Collect the hops from the node up, then turn the list around */
+  n = 0;
+  for(p = node->parent; p != NULL && !is_root(p); p = p->parent) {
+    if(n == max) {
+      return -1;
+    }
+    uip_ipaddr_copy(&hops[n++], &p->addr);
+  }
+  if(p == NULL) {
+    return -1;
+  }
+
+  for(i = 0; i < n / 2; i++) {
+    uip_ipaddr_copy(&tmp, &hops[i]);
+    uip_ipaddr_copy(&hops[i], &hops[n - 1 - i]);
+    uip_ipaddr_copy(&hops[n - 1 - i], &tmp);
+  }
+  return n;
+}
+/*---------------------------------------------------------------------------*/
+rpl_ns_node_t *
+rpl_ns_node_head(void)
+{
+  return list_head(ns_list);
+}
+/*---------------------------------------------------------------------------*/
+rpl_ns_node_t *
+rpl_ns_node_next(rpl_ns_node_t *node)
+{
+  return list_item_next(node);
+}
+/*---------------------------------------------------------------------------*/
+static rpl_ns_node_t *
+addr_from(rpl_ns_node_t *node, uip_ipaddr_t *addr)
+{
+  for(; node != NULL; node = node->hash_next) {
+    if(uip_ipaddr_cmp(&node->addr, addr)) {
+      return node;
+    }
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+rpl_ns_node_t *
+rpl_ns_addr_head(uip_ipaddr_t *addr)
+{
+  return addr_from(*node_bucket(addr), addr);
+}
+/*---------------------------------------------------------------------------*/
+rpl_ns_node_t *
+rpl_ns_addr_next(rpl_ns_node_t *node)
+{
+  return addr_from(node->hash_next, &node->addr);
+}
+/*---------------------------------------------------------------------------*/
+void
+rpl_ns_periodic(void)
+{
+  struct heap_node *n;
+  rpl_ns_node_t *node;
+  unsigned long now;
+
+  now = clock_seconds();
+  while((n = heap_peek(&ns_heap)) != NULL && n->key <= now) {
+    node = node_of(n);
+    PRINTF("RPL: Non-storing link from ");
+    PRINT6ADDR(&node->addr);
+    PRINTF(" expired\n");
+    if(node->dag != NULL) {
+      rpl_dtsn_request(node->dag->instance);
+    }
+    rpl_ns_remove_node(node);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/** @} */
@@ -0,0 +1,121 @@
+/**
+ * \addtogroup uip6
+ * @{
+ */
+
+/**
+ * \file
+ *         RPL non-storing mode: the DAO parent graph kept by the root
+ *
+ *         In non-storing mode every node reports its DAO parent to the
+ *         root, which is the only one to hold downward routes. The root
+ *         keeps one link per target and computes source routes by
+ *         walking the links up to itself.
+ */
+
+#ifndef RPL_NS_H
+#define RPL_NS_H
+
+#include "net/rpl/rpl.h"
+#include "lib/heap.h"
+
+/* Number of links the root can hold */
+#ifdef RPL_CONF_NS_LINK_NUM
+#define RPL_NS_LINK_NUM RPL_CONF_NS_LINK_NUM
+#else
+#define RPL_NS_LINK_NUM 32
+#endif
+
+/* Buckets of the node address index, a power of two */
+#ifdef RPL_CONF_NS_HASH_SIZE
+#define RPL_NS_HASH_SIZE RPL_CONF_NS_HASH_SIZE
+#else
+#define RPL_NS_HASH_SIZE 64
+#endif
+
+/* Longest source route, in intermediate hops */
+#ifdef RPL_CONF_NS_MAX_HOPS
+#define RPL_NS_MAX_HOPS RPL_CONF_NS_MAX_HOPS
+#else
+#define RPL_NS_MAX_HOPS 16
+#endif
+
+/* Deadline of the node standing for the root itself */
+#define RPL_NS_INFINITE_LIFETIME 0xffffffff
+
+typedef struct rpl_ns_node {
+  struct rpl_ns_node *next;
+  struct rpl_ns_node *parent;   /**< DAO parent, NULL if unknown */
+  struct rpl_ns_node *children; /**< First node with this one as parent */
+  struct rpl_ns_node *sibling;  /**< Next child of the same parent */
+  struct rpl_ns_node *sibling_prev; /**< Previous child, NULL if first */
+  struct rpl_ns_node *hash_next; /**< Chain of the address index */
+  rpl_dag_t *dag;
+  uip_ipaddr_t addr;
+  uint32_t expires;             /**< clock_seconds() deadline */
+  struct heap_node expiry;      /**< Place in the expiry order */
+  uint8_t path_sequence;
+  uint8_t stale;                /**< From a previous DODAG version */
+} rpl_ns_node_t;
+
+/** Number of nodes in the graph */
+int rpl_ns_num_nodes(void);
+
+/** Look up the node of a DAG by address */
+rpl_ns_node_t *rpl_ns_get_node(rpl_dag_t *dag, uip_ipaddr_t *addr);
+
+/**
+ * The node in a slot of the graph, NULL if the slot is free. Slots are
+ * those of the route changes logged with UIP_DS6_ROUTE_SRCRT.
+ */
+rpl_ns_node_t *rpl_ns_get_slot(uint16_t slot);
+
+/**
+ * Record that child reaches the root through parent. The parent gets a
+ * node of its own when it has none yet. Returns NULL when the graph is
+ * full or the link would close a loop.
+ */
+rpl_ns_node_t *rpl_ns_update_node(rpl_dag_t *dag, uip_ipaddr_t *child,
+                                  uip_ipaddr_t *parent, uint32_t lifetime,
+                                  uint8_t path_sequence);
+
+/** Seconds left before a node expires */
+uint32_t rpl_ns_lifetime(rpl_ns_node_t *node);
+
+/** Let a node expire in the given number of seconds */
+void rpl_ns_set_lifetime(rpl_ns_node_t *node, uint32_t lifetime);
+
+/** Remove a node; its children lose their parent */
+void rpl_ns_remove_node(rpl_ns_node_t *node);
+
+/** Remove every node of a DAG */
+void rpl_ns_remove_nodes(rpl_dag_t *dag);
+
+/** Mark the nodes of a DAG stale, they expire within grace seconds */
+void rpl_ns_stale_nodes(rpl_dag_t *dag, uint32_t grace);
+
+/** Hand the nodes of a DAG over to another one */
+void rpl_ns_move_nodes(rpl_dag_t *from, rpl_dag_t *to);
+
+/**
+ * Fill hops with the intermediate hops from the root to node, the hop
+ * next to the root first, node itself excluded. Returns the number of
+ * hops, or -1 when node does not reach the root or the path is longer
+ * than max.
+ */
+int rpl_ns_get_path(rpl_ns_node_t *node, uip_ipaddr_t *hops, int max);
+
+/** Iterate over the graph */
+rpl_ns_node_t *rpl_ns_node_head(void);
+rpl_ns_node_t *rpl_ns_node_next(rpl_ns_node_t *node);
+
+/** Iterate over the nodes with an address, in every DAG */
+rpl_ns_node_t *rpl_ns_addr_head(uip_ipaddr_t *addr);
+rpl_ns_node_t *rpl_ns_addr_next(rpl_ns_node_t *node);
+
+/** Remove the links past their deadline, called once a second */
+void rpl_ns_periodic(void);
+
+#endif /* RPL_NS_H */
+
+/** @} */
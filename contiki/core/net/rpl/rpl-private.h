@@ -44,6 +44,7 @@
 #include "sys/clock.h"
 #include "sys/ctimer.h"
 #include "net/uip-ds6.h"
+#include "net/uip-pkt.h"
 
 /*---------------------------------------------------------------------------*/
 /** \brief Is IPv6 address addr the link-local, all-RPL-nodes
@@ -103,7 +104,13 @@
 /* Default values for RPL constants and variables. */
 
 /* The default value for the DAO timer. */
-#define RPL_DAO_LATENCY                 (CLOCK_SECOND * 4)
+#define RPL_DAO_LATENCY_SECONDS         4
+#define RPL_DAO_LATENCY                 (CLOCK_SECOND * RPL_DAO_LATENCY_SECONDS)
+
+#if RPL_REPAIR_PACING && \
+    RPL_ROUTE_STALE_GRACE <= RPL_REPAIR_WINDOW + RPL_DAO_LATENCY_SECONDS
+#error "RPL_ROUTE_STALE_GRACE must outlast a paced repair and its DAOs"
+#endif
 
 /* Special value indicating immediate removal. */
 #define RPL_ZERO_LIFETIME               0
@@ -214,6 +221,8 @@
 
 #define RPL_LOLLIPOP_IS_INIT(counter)		\
   ((counter) > RPL_LOLLIPOP_CIRCULAR_REGION)
+
+int rpl_lollipop_greater_than(int a, int b);
 /*---------------------------------------------------------------------------*/
 /* Logical representation of a DAG Information Object (DIO.) */
 struct rpl_dio {
@@ -239,6 +248,45 @@ struct rpl_dio {
 };
 typedef struct rpl_dio rpl_dio_t;
 
+/* Maximum number of targets taken from a single DAO. */
+#ifdef RPL_CONF_DAO_MAX_TARGETS
+#define RPL_DAO_MAX_TARGETS             RPL_CONF_DAO_MAX_TARGETS
+#else
+#define RPL_DAO_MAX_TARGETS             16
+#endif
+
+/* A DAO target with the transit information that applies to it. */
+struct rpl_dao_target {
+  uip_ipaddr_t prefix;
+  uip_ipaddr_t parent;
+  uip_ds6_route_t *route;
+  uint8_t length;
+  uint8_t lifetime;
+  uint8_t path_control;
+  uint8_t path_sequence;
+  uint8_t has_parent;
+  uint8_t stale;                /* Older than the route we already have */
+};
+typedef struct rpl_dao_target rpl_dao_target_t;
+
+/*
+ * An RPL control message, where it came from and the packet replies and
+ * forwarded messages are built in. The handlers read nothing else of the
+ * packet and never write to uip_buf, so a message can be processed out
+ * of any buffer and while another one is.
+ */
+struct rpl_icmp6_ctx {
+  uip_ipaddr_t src;
+  uip_ipaddr_t dst;
+  uip_lladdr_t *lladdr;         /* Link-layer sender, NULL if unknown */
+  unsigned char *buffer;        /* Message body, past the ICMPv6 header */
+  uint16_t len;
+  uint8_t code;
+  uint8_t link;                 /* Link the message was received on */
+  struct uip_pkt *out;          /* Output packet, NULL to send nothing */
+};
+typedef struct rpl_icmp6_ctx rpl_icmp6_ctx_t;
+
 #if RPL_CONF_STATS
 /* Statistics for fault management. */
 struct rpl_stats {
@@ -269,8 +317,9 @@ extern rpl_instance_t *default_instance;
 /* ICMPv6 functions for RPL. */
 void dis_output(uip_ipaddr_t *addr);
 void dio_output(rpl_instance_t *, uip_ipaddr_t *uc_addr);
+void rpl_dio_invalidate(rpl_instance_t *);
 void dao_output(rpl_parent_t *, uint8_t lifetime);
-void dao_ack_output(rpl_instance_t *, uip_ipaddr_t *, uint8_t);
+void rpl_icmp6_input(rpl_icmp6_ctx_t *);
 
 /* RPL logic functions. */
 void rpl_join_dag(uip_ipaddr_t *from, rpl_dio_t *dio);
@@ -301,6 +350,16 @@ void rpl_remove_routes(rpl_dag_t *dag);
 void rpl_remove_routes_by_nexthop(uip_ipaddr_t *nexthop, rpl_dag_t *dag);
 uip_ds6_route_t *rpl_add_route(rpl_dag_t *dag, uip_ipaddr_t *prefix,
                                int prefix_len, uip_ipaddr_t *next_hop);
+int rpl_count_routes(rpl_dag_t *dag);
+void rpl_stale_routes(rpl_dag_t *dag);
+/* End of a chain of the route indexes kept by rpl.c */
+#define RPL_ROUTE_NONE 0xffff
+void rpl_route_removed(uip_ds6_route_t *route);
+uint32_t rpl_route_lifetime(uip_ds6_route_t *route);
+void rpl_route_set_lifetime(uip_ds6_route_t *route, uint32_t lifetime);
+void rpl_move_routes(rpl_dag_t *from, rpl_dag_t *to);
+int rpl_add_routes(rpl_dag_t *dag, rpl_dao_target_t *targets, int count,
+                   uip_ipaddr_t *next_hop, uint8_t learned_from);
 void rpl_purge_routes(void);
 
 /* Objective function. */
@@ -311,6 +370,11 @@ void rpl_schedule_dao(rpl_instance_t *);
 void rpl_reset_dio_timer(rpl_instance_t *);
 void rpl_reset_periodic_timer(void);
 
+/* DTSN policy, see rpl-conf.h. */
+void rpl_dtsn_increment(rpl_instance_t *);
+void rpl_dtsn_request(rpl_instance_t *);
+void rpl_repair_start(rpl_instance_t *);
+
 /* Route poisoning. */
 void rpl_poison_routes(rpl_dag_t *, rpl_parent_t *);
 
@@ -41,30 +41,48 @@
 
 #include "contiki-conf.h"
 #include "net/rpl/rpl-private.h"
+#include "net/rpl/rpl-ns.h"
 #include "lib/random.h"
 #include "sys/ctimer.h"
 
 #define DEBUG DEBUG_NONE
 #include "net/uip-debug.h"
 
+#if RPL_REPAIR_PACING && !RPL_LEAF_ONLY
+extern uip_ds6_nbr_t uip_ds6_nbr_cache[UIP_DS6_NBR_NB];
+#endif /* RPL_REPAIR_PACING && !RPL_LEAF_ONLY */
+
 /************************************************************************/
 static struct ctimer periodic_timer;
 
 static void handle_periodic_timer(void *ptr);
+static void handle_dtsn_policy(void);
+#if RPL_REPAIR_PACING && !RPL_LEAF_ONLY
+static void handle_repair_pacing(void);
+#endif /* RPL_REPAIR_PACING && !RPL_LEAF_ONLY */
+#if RPL_ADAPTIVE_TRICKLE && !RPL_LEAF_ONLY
+static void handle_trickle_adaptation(void);
+#endif /* RPL_ADAPTIVE_TRICKLE && !RPL_LEAF_ONLY */
 static void new_dio_interval(rpl_instance_t *instance);
 static void handle_dio_timer(void *ptr);
 
 static uint16_t next_dis;
 
-/* dio_send_ok is true if the node is ready to send DIOs */
-static uint8_t dio_send_ok;
 
 /************************************************************************/
 static void
 handle_periodic_timer(void *ptr)
 {
   rpl_purge_routes();
+  rpl_ns_periodic();
   rpl_recalculate_ranks();
+  handle_dtsn_policy();
+#if RPL_REPAIR_PACING && !RPL_LEAF_ONLY
+  handle_repair_pacing();
+#endif /* RPL_REPAIR_PACING && !RPL_LEAF_ONLY */
+#if RPL_ADAPTIVE_TRICKLE && !RPL_LEAF_ONLY
+  handle_trickle_adaptation();
+#endif /* RPL_ADAPTIVE_TRICKLE && !RPL_LEAF_ONLY */
 
   /* handle DIS */
 #ifdef RPL_DIS_SEND
@@ -131,9 +149,10 @@ handle_dio_timer(void *ptr)
   instance = (rpl_instance_t *)ptr;
 
   PRINTF("RPL: DIO Timer triggered\n");
-  if(!dio_send_ok) {
+  if(!instance->dio_send_ok) {
+    uip_ds6_set_link(instance->link);
     if(uip_ds6_get_link_local(ADDR_PREFERRED) != NULL) {
-      dio_send_ok = 1;
+      instance->dio_send_ok = 1;
     } else {
       PRINTF("RPL: Postponing DIO transmission since link local address is not ok\n");
       ctimer_set(&instance->dio_timer, CLOCK_SECOND, &handle_dio_timer, instance);
@@ -143,7 +162,9 @@ handle_dio_timer(void *ptr)
 
   if(instance->dio_send) {
     /* send DIO if counter is less than desired redundancy */
-    if(instance->dio_counter < instance->dio_redundancy) {
+    if(instance->repair_active) {
+      PRINTF("RPL: Holding the multicast DIO during a paced repair\n");
+    } else if(instance->dio_counter < instance->dio_redundancy) {
 #if RPL_CONF_STATS
       instance->dio_totsend++;
 #endif /* RPL_CONF_STATS */
@@ -167,6 +188,261 @@ handle_dio_timer(void *ptr)
 }
 /************************************************************************/
 void
+rpl_dtsn_increment(rpl_instance_t *instance)
+{
+  RPL_LOLLIPOP_INCREMENT(instance->dtsn_out);
+  instance->dtsn_pending = 0;
+  instance->dtsn_age = 0;
+}
+/************************************************************************/
+/* Ask the sub-DODAG for new DAOs; the DTSN policy decides when. */
+void
+rpl_dtsn_request(rpl_instance_t *instance)
+{
+  PRINTF("RPL: DAO refresh requested for instance %u\n", instance->instance_id);
+  instance->dtsn_pending = 1;
+}
+/************************************************************************/
+static void
+handle_dtsn_policy(void)
+{
+  rpl_instance_t *instance;
+  rpl_instance_t *end;
+
+  for(instance = &instance_table[0], end = instance + RPL_MAX_INSTANCES;
+      instance < end; ++instance) {
+    if(!instance->used || instance->current_dag == NULL) {
+      continue;
+    }
+    if(instance->dtsn_age < 0xffff) {
+      instance->dtsn_age++;
+    }
+
+#if RPL_DTSN_REFRESH_PERIOD
+    if(instance->current_dag->rank == ROOT_RANK(instance) &&
+       instance->dtsn_age >= RPL_DTSN_REFRESH_PERIOD) {
+      /* Routine refresh, the next DIO carries it */
+      PRINTF("RPL: Periodic DAO refresh\n");
+      rpl_dtsn_increment(instance);
+#if RPL_REPAIR_PACING
+      rpl_repair_start(instance);
+#endif /* RPL_REPAIR_PACING */
+      continue;
+    }
+#endif /* RPL_DTSN_REFRESH_PERIOD */
+
+    if(instance->dtsn_pending) {
+#if RPL_DTSN_POLICY == RPL_DTSN_PACED
+      if(instance->dtsn_age < RPL_DTSN_MIN_INTERVAL) {
+        continue;
+      }
+#endif /* RPL_DTSN_POLICY == RPL_DTSN_PACED */
+      /* Routes are missing: let the DODAG hear about it soon */
+      rpl_dtsn_increment(instance);
+      rpl_repair_start(instance);
+    }
+  }
+}
+/************************************************************************/
+/*
+ * Spread a new version or DTSN over the DODAG, see RPL_REPAIR_PACING.
+ * Nodes other than the root, or without pacing, reset Trickle and let
+ * the next multicast DIO carry it.
+ */
+void
+rpl_repair_start(rpl_instance_t *instance)
+{
+#if RPL_REPAIR_PACING && !RPL_LEAF_ONLY
+  if(instance->current_dag->rank == ROOT_RANK(instance)) {
+    if(instance->repair_active) {
+      /*
+       * Join the wave in progress rather than rewinding it, which would
+       * starve the neighbors late in the cache while requests keep coming.
+       * Those released with older values hear the new ones from the
+       * multicast DIO that ends the wave.
+       */
+      PRINTF("RPL: Paced repair of instance %u extended\n",
+             instance->instance_id);
+      return;
+    }
+    instance->repair_active = 1;
+    instance->repair_batch = 1;
+    instance->repair_age = 0;
+    instance->repair_dao = 0;
+    instance->repair_cursor = 0;
+    PRINTF("RPL: Paced repair of instance %u started\n",
+           instance->instance_id);
+    return;
+  }
+#endif /* RPL_REPAIR_PACING && !RPL_LEAF_ONLY */
+  rpl_reset_dio_timer(instance);
+}
+/************************************************************************/
+#if RPL_REPAIR_PACING && !RPL_LEAF_ONLY
+static void
+repair_instance(rpl_instance_t *instance)
+{
+  uip_ds6_nbr_t *nbr;
+  uint16_t rate;
+  int released;
+
+  rate = instance->repair_dao;
+  instance->repair_dao = 0;
+
+  if(++instance->repair_age >= RPL_REPAIR_WINDOW) {
+    PRINTF("RPL: Paced repair out of time, multicasting\n");
+    instance->repair_cursor = UIP_DS6_NBR_NB;
+  } else if(rate > RPL_REPAIR_DAO_RATE) {
+    /* The root is behind, release nobody this second */
+    instance->repair_batch = instance->repair_batch > 1 ?
+      instance->repair_batch / 2 : 1;
+    PRINTF("RPL: Paced repair backing off, %u DAO/s\n", rate);
+    return;
+  } else if(rate < RPL_REPAIR_DAO_RATE / 2 &&
+            instance->repair_batch < RPL_REPAIR_BATCH_MAX) {
+    instance->repair_batch++;
+  }
+
+  released = 0;
+  while(instance->repair_cursor < UIP_DS6_NBR_NB &&
+        released < instance->repair_batch) {
+    nbr = &uip_ds6_nbr_cache[instance->repair_cursor++];
+    if(nbr->isused && nbr->link == instance->link) {
+      dio_output(instance, &nbr->ipaddr);
+      released++;
+    }
+  }
+
+  if(instance->repair_cursor >= UIP_DS6_NBR_NB) {
+    PRINTF("RPL: Paced repair of instance %u done after %u s\n",
+           instance->instance_id, instance->repair_age);
+    instance->repair_active = 0;
+    /* Whoever was not in the neighbor cache learns it from multicast */
+    instance->dio_intcurrent = instance->dio_intmin + 1;
+    rpl_reset_dio_timer(instance);
+  }
+}
+/************************************************************************/
+static void
+handle_repair_pacing(void)
+{
+  rpl_instance_t *instance;
+  rpl_instance_t *end;
+
+  for(instance = &instance_table[0], end = instance + RPL_MAX_INSTANCES;
+      instance < end; ++instance) {
+    if(!instance->used || !instance->repair_active) {
+      continue;
+    }
+    if(instance->current_dag == NULL ||
+       instance->current_dag->rank != ROOT_RANK(instance)) {
+      instance->repair_active = 0;
+      continue;
+    }
+    repair_instance(instance);
+  }
+}
+#endif /* RPL_REPAIR_PACING && !RPL_LEAF_ONLY */
+/************************************************************************/
+#if RPL_ADAPTIVE_TRICKLE && !RPL_LEAF_ONLY
+/* Retune the Trickle parameters a root advertises, see rpl-conf.h. */
+static void
+adapt_instance(rpl_instance_t *instance)
+{
+  unsigned long size;
+  unsigned long n;
+  uint8_t intmin;
+  uint8_t intdoubl;
+  uint8_t redundancy;
+  int unstable;
+  int quiet;
+
+  size = rpl_count_routes(instance->current_dag);
+
+  intmin = RPL_ADAPT_IMIN_MIN;
+  for(n = size / RPL_ADAPT_SIZE_BASE; n > 1 && intmin < RPL_ADAPT_IMIN_MAX;
+      n >>= 1) {
+    intmin++;
+  }
+
+  unstable = instance->dis_rx > RPL_ADAPT_DIS_THRESHOLD ||
+    (unsigned long)instance->dao_rx * 100 > size * RPL_ADAPT_CHURN_PERCENT;
+  quiet = instance->dis_rx == 0 &&
+    (unsigned long)instance->dao_rx * 100 <= size * RPL_ADAPT_CHURN_PERCENT / 2;
+
+  intdoubl = instance->dio_intdoubl;
+  redundancy = instance->dio_redundancy;
+  if(unstable) {
+    intdoubl = intdoubl > RPL_ADAPT_DOUBLINGS_MIN + 2 ?
+      intdoubl - 2 : RPL_ADAPT_DOUBLINGS_MIN;
+    if(redundancy < RPL_ADAPT_REDUNDANCY_MAX) {
+      redundancy++;
+    }
+  } else if(quiet) {
+    if(intdoubl < RPL_ADAPT_DOUBLINGS_MAX) {
+      intdoubl++;
+    }
+    if(redundancy > RPL_ADAPT_REDUNDANCY_MIN) {
+      redundancy--;
+    }
+  }
+  if(intdoubl < RPL_ADAPT_DOUBLINGS_MIN) {
+    intdoubl = RPL_ADAPT_DOUBLINGS_MIN;
+  } else if(intdoubl > RPL_ADAPT_DOUBLINGS_MAX) {
+    intdoubl = RPL_ADAPT_DOUBLINGS_MAX;
+  }
+  if(redundancy < RPL_ADAPT_REDUNDANCY_MIN) {
+    redundancy = RPL_ADAPT_REDUNDANCY_MIN;
+  } else if(redundancy > RPL_ADAPT_REDUNDANCY_MAX) {
+    redundancy = RPL_ADAPT_REDUNDANCY_MAX;
+  }
+
+  PRINTF("RPL: Trickle adaptation: %lu nodes, %u DAO, %u DIS -> Imin %u, doublings %u, k %u\n",
+         size, instance->dao_rx, instance->dis_rx,
+         intmin, intdoubl, redundancy);
+
+  instance->dao_rx = 0;
+  instance->dis_rx = 0;
+
+  if(intmin == instance->dio_intmin && intdoubl == instance->dio_intdoubl &&
+     redundancy == instance->dio_redundancy) {
+    return;
+  }
+
+  instance->dio_intmin = intmin;
+  instance->dio_intdoubl = intdoubl;
+  instance->dio_redundancy = redundancy;
+  rpl_dio_invalidate(instance);
+
+  /* Keep the running interval inside the new bounds */
+  if(instance->dio_intcurrent > intmin + intdoubl) {
+    instance->dio_intcurrent = intmin + intdoubl;
+  } else if(instance->dio_intcurrent < intmin) {
+    instance->dio_intcurrent = intmin;
+  }
+}
+/************************************************************************/
+static void
+handle_trickle_adaptation(void)
+{
+  rpl_instance_t *instance;
+  rpl_instance_t *end;
+
+  for(instance = &instance_table[0], end = instance + RPL_MAX_INSTANCES;
+      instance < end; ++instance) {
+    if(!instance->used || instance->current_dag == NULL ||
+       instance->current_dag->rank != ROOT_RANK(instance)) {
+      continue;
+    }
+    if(++instance->adapt_age >= RPL_ADAPT_PERIOD) {
+      instance->adapt_age = 0;
+      adapt_instance(instance);
+    }
+  }
+}
+#endif /* RPL_ADAPTIVE_TRICKLE && !RPL_LEAF_ONLY */
+/************************************************************************/
+void
 rpl_reset_periodic_timer(void)
 {
   next_dis = RPL_DIS_INTERVAL - RPL_DIS_START_DELAY;
@@ -198,7 +474,8 @@ handle_dao_timer(void *ptr)
 
   instance = (rpl_instance_t *)ptr;
 
-  if(!dio_send_ok && uip_ds6_get_link_local(ADDR_PREFERRED) == NULL) {
+  uip_ds6_set_link(instance->link);
+  if(!instance->dio_send_ok && uip_ds6_get_link_local(ADDR_PREFERRED) == NULL) {
     PRINTF("RPL: Postpone DAO transmission\n");
     ctimer_set(&instance->dao_timer, CLOCK_SECOND, handle_dao_timer, instance);
     return;
@@ -44,7 +44,9 @@
 #include "net/tcpip.h"
 #include "net/uip-ds6.h"
 #include "net/rpl/rpl-private.h"
+#include "net/rpl/rpl-ns.h"
 #include "net/neighbor-info.h"
+#include "lib/heap.h"
 
 #define DEBUG DEBUG_NONE
 #include "net/uip-debug.h"
@@ -61,47 +63,203 @@ static rpl_parent_t *p;
 static rpl_parent_t *parent;
 /************************************************************************/
 extern uip_ds6_route_t uip_ds6_routing_table[UIP_DS6_ROUTE_NB];
+/*
+ * Route deadlines in expiry order. The nodes belong to the table slots
+ * rather than to the route state, which uip_ds6_route_set() clears. A
+ * slot freed by uip_ds6_route_rm() stays in the heap until its deadline
+ * and is skipped then, unless a new route took it and moved the key.
+ */
+static struct heap_node route_expiry[UIP_DS6_ROUTE_NB];
+HEAP(route_heap, UIP_DS6_ROUTE_NB);
+
+/*
+ * DAG index: the routes of a DAG are chained by slot number from its
+ * route_head, those handed over by rpl_move_routes() to no DAG from
+ * orphan_routes. route_set_dag() is the only writer of state.dag.
+ */
+static uint16_t dag_next[UIP_DS6_ROUTE_NB];
+static uint16_t dag_prev[UIP_DS6_ROUTE_NB];
+static uint8_t dag_linked[UIP_DS6_ROUTE_NB];
+static uint16_t orphan_routes;
+/************************************************************************/
+static uint16_t *
+dag_head(rpl_dag_t *dag)
+{
+  return dag != NULL ? &dag->route_head : &orphan_routes;
+}
+/************************************************************************/
+static void
+dag_unlink(uip_ds6_route_t *route)
+{
+  uint16_t i;
+
+  i = route - uip_ds6_routing_table;
+  if(!dag_linked[i]) {
+    return;
+  }
+  if(dag_prev[i] == RPL_ROUTE_NONE) {
+    *dag_head(route->state.dag) = dag_next[i];
+  } else {
+    dag_next[dag_prev[i]] = dag_next[i];
+  }
+  if(dag_next[i] != RPL_ROUTE_NONE) {
+    dag_prev[dag_next[i]] = dag_prev[i];
+  }
+  dag_linked[i] = 0;
+}
+/************************************************************************/
+static void
+route_set_dag(uip_ds6_route_t *route, rpl_dag_t *dag)
+{
+  uint16_t *head;
+  uint16_t i;
+
+  i = route - uip_ds6_routing_table;
+  if(dag_linked[i] && route->state.dag == dag) {
+    return;
+  }
+  dag_unlink(route);
+  route->state.dag = dag;
+  head = dag_head(dag);
+  dag_prev[i] = RPL_ROUTE_NONE;
+  dag_next[i] = *head;
+  if(*head != RPL_ROUTE_NONE) {
+    dag_prev[*head] = i;
+  }
+  *head = i;
+  dag_linked[i] = 1;
+}
+/************************************************************************/
+/* Called by uip-ds6 before a route slot is freed or reused. */
+void
+rpl_route_removed(uip_ds6_route_t *route)
+{
+  dag_unlink(route);
+}
+/************************************************************************/
+uint32_t
+rpl_route_lifetime(uip_ds6_route_t *route)
+{
+  unsigned long now;
+
+  now = clock_seconds();
+  return route->state.expires > now ? route->state.expires - now : 0;
+}
+/************************************************************************/
+void
+rpl_route_set_lifetime(uip_ds6_route_t *route, uint32_t lifetime)
+{
+  route->state.expires = clock_seconds() + lifetime;
+  heap_set(&route_heap, &route_expiry[route - uip_ds6_routing_table],
+           route->state.expires);
+}
 /************************************************************************/
 void
 rpl_purge_routes(void)
 {
-  int i;
+  struct heap_node *n;
+  uip_ds6_route_t *route;
+  unsigned long now;
 
-  for(i = 0; i < UIP_DS6_ROUTE_NB; i++) {
-    if(uip_ds6_routing_table[i].isused) {
-      if(uip_ds6_routing_table[i].state.lifetime <= 1) {
-        uip_ds6_route_rm(&uip_ds6_routing_table[i]);
-      } else {
-        uip_ds6_routing_table[i].state.lifetime--;
-      }
+  now = clock_seconds();
+  while((n = heap_peek(&route_heap)) != NULL && n->key <= now) {
+    heap_pop(&route_heap);
+    route = &uip_ds6_routing_table[n - route_expiry];
+    if(!route->isused) {
+      continue;
+    }
+    /* A route learned from a DAO timed out: ask for it again */
+    if(route->state.dag != NULL &&
+       route->state.learned_from != RPL_ROUTE_FROM_INTERNAL) {
+      rpl_dtsn_request(((rpl_dag_t *)route->state.dag)->instance);
+    }
+    uip_ds6_route_rm(route);
+  }
+}
+/************************************************************************/
+/* Number of downward routes of a DAG, non-storing links included. */
+int
+rpl_count_routes(rpl_dag_t *dag)
+{
+  rpl_ns_node_t *node;
+  uint16_t i;
+  int n;
+
+  n = 0;
+  for(i = *dag_head(dag); i != RPL_ROUTE_NONE; i = dag_next[i]) {
+    n++;
+  }
+  for(node = rpl_ns_node_head(); node != NULL; node = rpl_ns_node_next(node)) {
+    if(node->dag == dag) {
+      n++;
     }
   }
+  return n;
 }
 /************************************************************************/
 void
 rpl_remove_routes(rpl_dag_t *dag)
 {
-  int i;
+  uint16_t i;
 
-  for(i = 0; i < UIP_DS6_ROUTE_NB; i++) {
-    if(uip_ds6_routing_table[i].state.dag == dag) {
-      uip_ds6_route_rm(&uip_ds6_routing_table[i]);
+  /* uip_ds6_route_rm() unlinks the head through rpl_route_removed() */
+  while((i = *dag_head(dag)) != RPL_ROUTE_NONE) {
+    uip_ds6_route_rm(&uip_ds6_routing_table[i]);
+  }
+  rpl_ns_remove_nodes(dag);
+}
+/************************************************************************/
+/*
+ * Keep the routes of a DAG installed across a version change or a new
+ * root, but let them expire after RPL_ROUTE_STALE_GRACE seconds unless
+ * a DAO refreshes them.
+ */
+void
+rpl_stale_routes(rpl_dag_t *dag)
+{
+  uip_ds6_route_t *locroute;
+  uint16_t i;
+
+  for(i = *dag_head(dag); i != RPL_ROUTE_NONE; i = dag_next[i]) {
+    locroute = &uip_ds6_routing_table[i];
+    if(locroute->state.learned_from != RPL_ROUTE_FROM_INTERNAL) {
+      locroute->state.stale = 1;
+      if(rpl_route_lifetime(locroute) > RPL_ROUTE_STALE_GRACE) {
+        rpl_route_set_lifetime(locroute, RPL_ROUTE_STALE_GRACE);
+      }
     }
   }
+  rpl_ns_stale_nodes(dag, RPL_ROUTE_STALE_GRACE);
+}
+/************************************************************************/
+/* Hand the routes of a DAG over to another one, NULL while in between. */
+void
+rpl_move_routes(rpl_dag_t *from, rpl_dag_t *to)
+{
+  uint16_t i;
+
+  if(from == to) {
+    return;
+  }
+  while((i = *dag_head(from)) != RPL_ROUTE_NONE) {
+    route_set_dag(&uip_ds6_routing_table[i], to);
+  }
+  rpl_ns_move_nodes(from, to);
 }
 /************************************************************************/
 void
 rpl_remove_routes_by_nexthop(uip_ipaddr_t *nexthop, rpl_dag_t *dag)
 {
   uip_ds6_route_t *locroute;
+  uip_ds6_route_t *next;
 
-  for(locroute = uip_ds6_routing_table;
-      locroute < uip_ds6_routing_table + UIP_DS6_ROUTE_NB;
-      locroute++) {
-    if(locroute->isused
-        && uip_ipaddr_cmp(&locroute->nexthop, nexthop)
-        && locroute->state.dag == dag) {
-      locroute->isused = 0;
+  /* The parent is a link-local address on the link of the instance */
+  uip_ds6_set_link(dag->instance->link);
+  for(locroute = uip_ds6_route_nexthop_first(nexthop); locroute != NULL;
+      locroute = next) {
+    next = uip_ds6_route_nexthop_next(locroute);
+    if(locroute->state.dag == dag) {
+      uip_ds6_route_rm(locroute);
     }
   }
   ANNOTATE("#L %u 0\n",nexthop->u8[sizeof(uip_ipaddr_t) - 1]);
@@ -125,11 +283,15 @@ rpl_add_route(rpl_dag_t *dag, uip_ipaddr_t *prefix, int prefix_len,
     PRINTF(" to ");
     PRINT6ADDR(next_hop);
     PRINTF("\n");
-    uip_ipaddr_copy(&rep->nexthop, next_hop);
+    if(!uip_ds6_route_set_nexthop(rep, next_hop)) {
+      return NULL;
+    }
   }
-  rep->state.dag = dag;
-  rep->state.lifetime = RPL_LIFETIME(dag->instance, dag->instance->default_lifetime);
+  route_set_dag(rep, dag);
+  rpl_route_set_lifetime(rep, RPL_LIFETIME(dag->instance,
+                                           dag->instance->default_lifetime));
   rep->state.learned_from = RPL_ROUTE_FROM_INTERNAL;
+  rep->state.stale = 0;
 
   PRINTF("RPL: Added a route to ");
   PRINT6ADDR(prefix);
@@ -140,6 +302,89 @@ rpl_add_route(rpl_dag_t *dag, uip_ipaddr_t *prefix, int prefix_len,
   return rep;
 }
 /************************************************************************/
+/*
+ * Add or refresh the routes for a batch of DAO targets, all reached
+ * through next_hop, each found through the target index. Targets
+ * older than the route we have, by path sequence, are marked stale and
+ * left alone. Targets with a zero lifetime only get their existing
+ * route looked up. A refresh through the same next hop only extends
+ * the lifetime. Returns the number of targets left without a route.
+ */
+int
+rpl_add_routes(rpl_dag_t *dag, rpl_dao_target_t *targets, int count,
+               uip_ipaddr_t *next_hop, uint8_t learned_from)
+{
+  rpl_dao_target_t *t;
+  int missing;
+  int i;
+
+  if(count > RPL_DAO_MAX_TARGETS) {
+    count = RPL_DAO_MAX_TARGETS;
+  }
+
+  missing = 0;
+  for(i = 0; i < count; i++) {
+    t = &targets[i];
+    t->stale = 0;
+    t->route = uip_ds6_route_find(&t->prefix, t->length);
+    if(t->route != NULL && !t->route->state.stale &&
+       t->route->state.learned_from != RPL_ROUTE_FROM_INTERNAL &&
+       rpl_lollipop_greater_than(t->route->state.path_sequence,
+                                 t->path_sequence)) {
+      PRINTF("RPL: Stale DAO target ");
+      PRINT6ADDR(&t->prefix);
+      PRINTF(" (path sequence %u < %u)\n", t->path_sequence,
+             t->route->state.path_sequence);
+      t->stale = 1;
+      continue;
+    }
+    if(t->lifetime == RPL_ZERO_LIFETIME) {
+      continue;
+    }
+    if(t->route == NULL) {
+      t->route = uip_ds6_route_add(&t->prefix, t->length, next_hop, 0);
+      if(t->route == NULL) {
+        PRINTF("RPL: No space for more route entries\n");
+        missing++;
+        continue;
+      }
+      PRINTF("RPL: Added a route to ");
+      PRINT6ADDR(&t->prefix);
+      PRINTF("/%d via ", t->length);
+      PRINT6ADDR(next_hop);
+      PRINTF("\n");
+    } else if(!uip_ipaddr_cmp(uip_ds6_route_nexthop(t->route), next_hop) ||
+              !uip_ds6_same_link(next_hop, uip_ds6_route_link(t->route),
+                                 uip_ds6_link)) {
+      if(!uip_ds6_route_set_nexthop(t->route, next_hop)) {
+        missing++;
+        continue;
+      }
+      PRINTF("RPL: Updated the next hop for prefix ");
+      PRINT6ADDR(&t->prefix);
+      PRINTF(" to ");
+      PRINT6ADDR(next_hop);
+      PRINTF("\n");
+    } else if(t->route->state.path_sequence == t->path_sequence &&
+              t->route->state.dag == dag && !t->route->state.stale &&
+              t->route->state.learned_from == learned_from &&
+              t->route->state.saved_lifetime == 0) {
+      /* A pure refresh only moves the deadline */
+      rpl_route_set_lifetime(t->route,
+                             RPL_LIFETIME(dag->instance, t->lifetime));
+      continue;
+    }
+    route_set_dag(t->route, dag);
+    rpl_route_set_lifetime(t->route, RPL_LIFETIME(dag->instance, t->lifetime));
+    t->route->state.saved_lifetime = 0;
+    t->route->state.learned_from = learned_from;
+    t->route->state.path_sequence = t->path_sequence;
+    t->route->state.stale = 0;
+  }
+
+  return missing;
+}
+/************************************************************************/
 static void
 rpl_link_neighbor_callback(const rimeaddr_t *addr, int known, int etx)
 {
@@ -178,6 +423,13 @@ rpl_link_neighbor_callback(const rimeaddr_t *addr, int known, int etx)
     PRINT6ADDR(&ipaddr);
     PRINTF("\n");
     uip_ds6_route_rm_by_nexthop(&ipaddr);
+
+    /* The destinations behind that neighbor may be reachable another way */
+    for(instance = &instance_table[0], end = instance + RPL_MAX_INSTANCES; instance < end; ++instance) {
+      if(instance->used == 1) {
+        rpl_dtsn_request(instance);
+      }
+    }
   }
 }
 /************************************************************************/
@@ -208,9 +460,18 @@ void
 rpl_init(void)
 {
   uip_ipaddr_t rplmaddr;
+  int i;
+
   PRINTF("RPL started\n");
   default_instance = NULL;
 
+  for(i = 0; i < UIP_DS6_ROUTE_NB; i++) {
+    heap_node_init(&route_expiry[i]);
+    dag_linked[i] = 0;
+  }
+  orphan_routes = RPL_ROUTE_NONE;
+  heap_init(&route_heap);
+
   rpl_reset_periodic_timer();
   neighbor_info_subscribe(rpl_link_neighbor_callback);
 
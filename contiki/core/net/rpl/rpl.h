@@ -47,7 +47,7 @@
 
 /*---------------------------------------------------------------------------*/
 /* The amount of parents that this node has in a particular DAG. */
-#define RPL_PARENT_COUNT(dag)   list_length((dag)->parents)
+#define RPL_PARENT_COUNT(dag)   ((dag)->parent_count)
 /*---------------------------------------------------------------------------*/
 typedef uint16_t rpl_rank_t;
 typedef uint16_t rpl_ocp_t;
@@ -109,6 +109,7 @@ struct rpl_dag;
 /*---------------------------------------------------------------------------*/
 struct rpl_parent {
   struct rpl_parent *next;
+  struct rpl_parent *hash_next; /* chain of the parent address index */
   struct rpl_dag *dag;
   rpl_metric_container_t mc;
   uip_ipaddr_t addr;
@@ -142,6 +143,8 @@ struct rpl_dag {
   rpl_rank_t rank;
   struct rpl_instance *instance;
   LIST_STRUCT(parents);
+  uint16_t parent_count;
+  uint16_t route_head; /* first route slot of the DAG, see rpl.c */
   rpl_prefix_t prefix_info;
 };
 typedef struct rpl_dag rpl_dag_t;
@@ -194,6 +197,17 @@ struct rpl_of {
 typedef struct rpl_of rpl_of_t;
 /*---------------------------------------------------------------------------*/
 /* Instance */
+/* Longest DIO: base object, metric container, configuration and prefix. */
+#define RPL_DIO_MAX_LEN 96
+
+/* A DIS source of the link and its token bucket, see RPL_DIS_BURST */
+struct rpl_dis_source {
+  uip_ipaddr_t addr;
+  clock_time_t last; /* when the last token was added */
+  uint8_t tokens;
+  uint8_t used;
+};
+
 struct rpl_instance {
   /* DAG configuration */
   rpl_metric_container_t mc;
@@ -204,7 +218,11 @@ struct rpl_instance {
   uip_ds6_defrt_t *def_route;
   uint8_t instance_id;
   uint8_t used;
+  uint8_t link; /* the link the instance runs on, see uip_ds6_set_link() */
+  uint8_t dio_send_ok; /* a link-local address of the link is preferred */
   uint8_t dtsn_out;
+  uint8_t dtsn_pending; /* a DAO refresh waits for the DTSN policy */
+  uint16_t dtsn_age; /* seconds since dtsn_out last changed */
   uint8_t mop;
   uint8_t dio_intdoubl;
   uint8_t dio_intmin;
@@ -221,6 +239,26 @@ struct rpl_instance {
   uint16_t dio_totsend;
   uint16_t dio_totrecv;
 #endif /* RPL_CONF_STATS */
+  /* DIO image reused until rpl_dio_invalidate(), see dio_output() */
+  uint8_t dio_cache[RPL_DIO_MAX_LEN];
+  uint8_t dio_cache_len;
+  rpl_rank_t dio_cache_rank;
+  struct timer dis_reset_timer; /* paces Trickle resets by multicast DIS */
+  uint16_t dao_rx; /* DAOs received in the current adaptation period */
+  uint16_t dis_rx; /* DIS received in the current adaptation period */
+  uint16_t adapt_age; /* seconds into the adaptation period */
+  uint8_t repair_active; /* multicast DIOs held, see rpl_repair_start() */
+  uint8_t repair_batch; /* neighbors released per second */
+  uint16_t repair_age; /* seconds since the repair started */
+  uint16_t repair_dao; /* DAOs received in the last second */
+  uint16_t repair_cursor; /* next neighbor cache entry to release */
+  uint8_t dao_sequence; /* of the last DAO sent, see dao_output() */
+  /* DIS sources of the link and the unicast replies waiting to be sent */
+  struct rpl_dis_source dis_sources[RPL_DIS_SOURCES];
+  uip_ipaddr_t dis_pending[RPL_DIS_PENDING];
+  uint8_t dis_npending;
+  uint8_t dis_overflow;
+  struct ctimer dis_timer;
   uint32_t dio_next_delay; /* delay for completion of dio interval */
   struct ctimer dio_timer;
   struct ctimer dao_timer;
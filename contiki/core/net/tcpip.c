@@ -592,7 +592,9 @@ tcpip_ipv6_output(void)
           return;
         }
       } else {
-	nexthop = &locrt->nexthop;
+	nexthop = uip_ds6_route_nexthop(locrt);
+	/* Link-local next hops only mean something on their own link */
+	uip_ds6_set_link(uip_ds6_route_link(locrt));
       }
     }
     /* End of next hop determination */
@@ -628,6 +630,7 @@ tcpip_ipv6_output(void)
 
         stimer_set(&nbr->sendns, uip_ds6_if.retrans_timer / 1000);
         nbr->nscount = 1;
+        uip_ds6_nbr_schedule(nbr);
       }
     } else {
       if(nbr->state == NBR_INCOMPLETE) {
@@ -649,9 +652,12 @@ tcpip_ipv6_output(void)
         nbr->state = NBR_DELAY;
         stimer_set(&nbr->reachable, UIP_ND6_DELAY_FIRST_PROBE_TIME);
         nbr->nscount = 0;
+        uip_ds6_nbr_schedule(nbr);
         PRINTF("tcpip_ipv6_output: nbr cache entry stale moving to delay\n");
       }
 
+      /* The neighbor is reached on the link it was seen on */
+      uip_ds6_set_link(nbr->link);
       tcpip_output(&nbr->lladdr);
 
 #if UIP_CONF_IPV6_QUEUE_PKT
@@ -44,6 +44,7 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include "lib/random.h"
+#include "lib/heap.h"
 #include "net/uip-nd6.h"
 #include "net/uip-ds6.h"
 #include "net/uip-packetqueue.h"
@@ -58,6 +59,20 @@ void NEIGHBOR_STATE_CHANGED(uip_ds6_nbr_t *n);
 #define NEIGHBOR_STATE_CHANGED(n)
 #endif /* UIP_DS6_CONF_NEIGHBOR_STATE_CHANGED */
 
+#ifdef UIP_CONF_DS6_ROUTE_REMOVED
+#define ROUTE_REMOVED(r) UIP_CONF_DS6_ROUTE_REMOVED(r)
+void ROUTE_REMOVED(uip_ds6_route_t *r);
+#else
+#define ROUTE_REMOVED(r)
+#endif /* UIP_CONF_DS6_ROUTE_REMOVED */
+
+#ifdef UIP_CONF_DS6_LINK_SELECTED
+#define LINK_SELECTED(l) UIP_CONF_DS6_LINK_SELECTED(l)
+void LINK_SELECTED(uint8_t link);
+#else
+#define LINK_SELECTED(l)
+#endif /* UIP_CONF_DS6_LINK_SELECTED */
+
 struct etimer uip_ds6_timer_periodic;                           /** \brief Timer for maintenance of data structures */
 
 #if UIP_CONF_ROUTER
@@ -79,6 +94,76 @@ uip_ds6_defrt_t uip_ds6_defrt_list[UIP_DS6_DEFRT_NB];             /** \brief Def
 uip_ds6_prefix_t uip_ds6_prefix_list[UIP_DS6_PREFIX_NB];          /** \brief Prefix list */
 uip_ds6_route_t uip_ds6_routing_table[UIP_DS6_ROUTE_NB];          /** \brief Routing table */
 
+/*
+ * Route keys. A target of /64 or longer is kept as its interface id
+ * below one of a few shared /64 route prefixes, typically the DODAG
+ * prefix; the other targets take a slot of the full target table.
+ * Each next hop is kept once, in the next hop table, and found by a
+ * hash of its address. The routes through a next hop are chained from
+ * its entry, so that they are found without scanning the table. Each
+ * slot of the table is also on one target list: the bucket of its key
+ * when used, the free list otherwise. Links are slot numbers,
+ * ROUTE_NONE ends a chain.
+ */
+#define ROUTE_NONE 0xffff
+
+static struct {
+  uint8_t prefix[8];
+  uint16_t refs;                /* Routes below the prefix, 0 when free */
+} route_prefix[UIP_DS6_ROUTE_PREFIX_NB];
+
+static uip_ipaddr_t route_full[UIP_DS6_ROUTE_FULL_NB];
+static uint8_t route_full_used[UIP_DS6_ROUTE_FULL_NB];
+
+static struct {
+  uip_ipaddr_t ipaddr;
+  uint16_t routes;              /* First route through it */
+  uint16_t next;                /* Next in the bucket or the free list */
+  uint8_t link;                 /* Link it was learned on */
+} route_nexthop[UIP_DS6_ROUTE_NEXTHOP_NB];
+
+static uint16_t nexthop_bucket[UIP_DS6_ROUTE_NEXTHOP_HASH];
+static uint16_t nexthop_free;
+static uint16_t nexthop_next[UIP_DS6_ROUTE_NB];
+static uint16_t nexthop_prev[UIP_DS6_ROUTE_NB];
+
+static uint16_t route_bucket[UIP_DS6_ROUTE_HASH];
+static uint16_t route_free_list;
+static uint16_t route_next[UIP_DS6_ROUTE_NB];
+static uint16_t route_prev[UIP_DS6_ROUTE_NB];
+
+static uip_ds6_route_t *nexthop_first(uip_ipaddr_t *nexthop, uint8_t link);
+
+/*
+ * Route change log, read by the code mirroring the routes, e.g. into a
+ * kernel. A full log is dropped; the reader then learns from
+ * uip_ds6_route_log_lost() that it has to compare everything.
+ */
+#if UIP_DS6_ROUTE_LOG_NB
+static uip_ds6_route_change_t route_log[UIP_DS6_ROUTE_LOG_NB];
+static uint16_t route_log_head;
+static uint16_t route_log_count;
+#endif
+static uint8_t route_log_lost;
+
+/*
+ * Neighbors waiting for a timer of their state, by deadline in
+ * seconds. Nodes belong to cache slots; see uip_ds6_nbr_schedule().
+ */
+static struct heap_node nbr_expiry[UIP_DS6_NBR_NB];
+HEAP(nbr_heap, UIP_DS6_NBR_NB);
+
+/*
+ * Replacement of a full neighbor cache: a CLOCK hand sweeps the slots,
+ * giving a second chance to the neighbors looked up since it last
+ * passed. See nbr_evict().
+ */
+uip_ds6_nbr_stats_t uip_ds6_nbr_stats;
+static uint16_t nbr_hand;
+
+/* Link of the packet being handled, see uip_ds6_set_link() */
+uint8_t uip_ds6_link;
+
 /* Used by Cooja to enable extraction of addresses from memory.*/
 uint8_t uip_ds6_addr_size;
 uint8_t uip_ds6_netif_addr_list_offset;
@@ -111,6 +196,31 @@ uip_ds6_init(void)
   memset(uip_ds6_prefix_list, 0, sizeof(uip_ds6_prefix_list));
   memset(&uip_ds6_if, 0, sizeof(uip_ds6_if));
   memset(uip_ds6_routing_table, 0, sizeof(uip_ds6_routing_table));
+  memset(nexthop_bucket, 0xff, sizeof(nexthop_bucket));
+  memset(route_bucket, 0xff, sizeof(route_bucket));
+  for(route_free_list = 0; route_free_list < UIP_DS6_ROUTE_NB;
+      route_free_list++) {
+    route_next[route_free_list] = route_free_list + 1;
+    route_prev[route_free_list] = route_free_list - 1;
+  }
+  route_next[UIP_DS6_ROUTE_NB - 1] = ROUTE_NONE;
+  route_free_list = 0;
+  route_prev[0] = ROUTE_NONE;
+  memset(route_prefix, 0, sizeof(route_prefix));
+  memset(route_full_used, 0, sizeof(route_full_used));
+  for(nexthop_free = 0; nexthop_free < UIP_DS6_ROUTE_NEXTHOP_NB;
+      nexthop_free++) {
+    route_nexthop[nexthop_free].next = nexthop_free + 1;
+  }
+  route_nexthop[UIP_DS6_ROUTE_NEXTHOP_NB - 1].next = ROUTE_NONE;
+  nexthop_free = 0;
+  for(locnbr = uip_ds6_nbr_cache;
+      locnbr < uip_ds6_nbr_cache + UIP_DS6_NBR_NB; locnbr++) {
+    heap_node_init(&nbr_expiry[locnbr - uip_ds6_nbr_cache]);
+  }
+  heap_init(&nbr_heap);
+  /* Whatever a mirror holds is unknown to the log */
+  route_log_lost = 1;
   uip_ds6_addr_size = sizeof(struct uip_ds6_addr);
   uip_ds6_netif_addr_list_offset = offsetof(struct uip_ds6_netif, addr_list);
 
@@ -155,6 +265,8 @@ uip_ds6_init(void)
 void
 uip_ds6_periodic(void)
 {
+  struct heap_node *n;
+  unsigned long now;
 
   /* Periodic processing on unicast addresses */
   for(locaddr = uip_ds6_if.addr_list;
@@ -167,6 +279,7 @@ uip_ds6_periodic(void)
                 && (locaddr->dadnscount <= uip_ds6_if.maxdadns)
                 && (timer_expired(&locaddr->dadtimer))
                 && (uip_len == 0)) {
+        uip_ds6_set_link(locaddr->link);
         uip_ds6_dad(locaddr);
 #endif /* UIP_ND6_DEF_MAXDADNS > 0 */
       }
@@ -194,18 +307,25 @@ uip_ds6_periodic(void)
   }
 #endif /* !UIP_CONF_ROUTER */
 
-  /* Periodic processing on neighbors */
-  for(locnbr = uip_ds6_nbr_cache;
-      locnbr < uip_ds6_nbr_cache + UIP_DS6_NBR_NB;
-      locnbr++) {
+  /* Periodic processing on the neighbors with a timer due */
+  now = clock_seconds();
+  while((n = heap_peek(&nbr_heap)) != NULL && n->key <= now) {
+    locnbr = &uip_ds6_nbr_cache[n - nbr_expiry];
+    if(uip_len != 0 &&
+       (locnbr->state == NBR_INCOMPLETE || locnbr->state == NBR_PROBE)) {
+      /* uip_buf is busy, the NS waits for the next period */
+      break;
+    }
+    heap_pop(&nbr_heap);
     if(locnbr->isused) {
       switch(locnbr->state) {
       case NBR_INCOMPLETE:
         if(locnbr->nscount >= UIP_ND6_MAX_MULTICAST_SOLICIT) {
           uip_ds6_nbr_rm(locnbr);
-        } else if(stimer_expired(&locnbr->sendns) && (uip_len == 0)) {
+        } else if(stimer_expired(&locnbr->sendns)) {
           locnbr->nscount++;
           PRINTF("NBR_INCOMPLETE: NS %u\n", locnbr->nscount);
+          uip_ds6_set_link(locnbr->link);
           uip_nd6_ns_output(NULL, NULL, &locnbr->ipaddr);
           stimer_set(&locnbr->sendns, uip_ds6_if.retrans_timer / 1000);
         }
@@ -235,9 +355,10 @@ uip_ds6_periodic(void)
             }
           }
           uip_ds6_nbr_rm(locnbr);
-        } else if(stimer_expired(&locnbr->sendns) && (uip_len == 0)) {
+        } else if(stimer_expired(&locnbr->sendns)) {
           locnbr->nscount++;
           PRINTF("PROBE: NS %u\n", locnbr->nscount);
+          uip_ds6_set_link(locnbr->link);
           uip_nd6_ns_output(NULL, &locnbr->ipaddr, &locnbr->ipaddr);
           stimer_set(&locnbr->sendns, uip_ds6_if.retrans_timer / 1000);
         }
@@ -245,6 +366,7 @@ uip_ds6_periodic(void)
       default:
         break;
       }
+      uip_ds6_nbr_schedule(locnbr);
     }
   }
 
@@ -258,9 +380,24 @@ uip_ds6_periodic(void)
   return;
 }
 
+/*---------------------------------------------------------------------------*/
+void
+uip_ds6_set_link(uint8_t link)
+{
+  if(link >= UIP_DS6_LINK_NB) {
+    PRINTF("No link %u\n", link);
+    return;
+  }
+  if(link != uip_ds6_link) {
+    uip_ds6_link = link;
+    /* The platform loads the link-layer address of the link */
+    LINK_SELECTED(link);
+  }
+}
+
 /*---------------------------------------------------------------------------*/
 uint8_t
-uip_ds6_list_loop(uip_ds6_element_t *list, uint8_t size,
+uip_ds6_list_loop(uip_ds6_element_t *list, uint16_t size,
                   uint16_t elementsize, uip_ipaddr_t *ipaddr,
                   uint8_t ipaddrlen, uip_ds6_element_t **out_element)
 {
@@ -285,6 +422,104 @@ uip_ds6_list_loop(uip_ds6_element_t *list, uint8_t size,
   return *out_element != NULL ? FREESPACE : NOSPACE;
 }
 
+/*---------------------------------------------------------------------------*/
+/*
+ * A neighbor that routes or a default router go through is never
+ * replaced, the traffic to it would be lost until it is resolved again.
+ */
+static int
+nbr_pinned(uip_ds6_nbr_t *nbr)
+{
+  return nexthop_first(&nbr->ipaddr, nbr->link) != NULL ||
+    uip_ds6_defrt_lookup(&nbr->ipaddr) != NULL;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Pick the neighbor to replace. The hand goes around twice at most, the
+ * first turn may only clear reference bits. A STALE non-router is taken
+ * as soon as the hand reaches it; otherwise the first other non-router
+ * met, then the first router. When a whole turn meets nothing but
+ * pinned neighbors, the add is refused without a second one.
+ */
+static uip_ds6_nbr_t *
+nbr_evict(void)
+{
+  uip_ds6_nbr_t *nbr;
+  uip_ds6_nbr_t *host;
+  uip_ds6_nbr_t *router;
+  uint16_t i;
+  uint8_t unpinned;
+
+  host = NULL;
+  router = NULL;
+  unpinned = 0;
+  for(i = 0; i < 2 * (UIP_DS6_NBR_NB); i++) {
+    if(i == UIP_DS6_NBR_NB && !unpinned) {
+      break;
+    }
+    nbr = &uip_ds6_nbr_cache[nbr_hand];
+    nbr_hand = (nbr_hand + 1) % (UIP_DS6_NBR_NB);
+    if(!nbr->isused) {
+      return nbr;
+    }
+    if(nbr_pinned(nbr)) {
+      continue;
+    }
+    unpinned = 1;
+    if(nbr->referenced) {
+      nbr->referenced = 0;
+      continue;
+    }
+    if(!nbr->isrouter && nbr->state == NBR_STALE) {
+      uip_ds6_nbr_stats.evicted_stale++;
+      host = nbr;
+      break;
+    }
+    if(!nbr->isrouter) {
+      if(host == NULL) {
+        host = nbr;
+      }
+    } else if(router == NULL) {
+      router = nbr;
+    }
+  }
+
+  nbr = host != NULL ? host : router;
+  if(nbr == NULL) {
+    return NULL;
+  }
+  PRINTF("Evicting neighbor ");
+  PRINT6ADDR(&nbr->ipaddr);
+  PRINTF(" state %u\n", nbr->state);
+  uip_ds6_nbr_stats.evicted++;
+  uip_ds6_nbr_rm(nbr);
+  return nbr;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Look a neighbor up on the current link, as uip_ds6_list_loop() does:
+ * FOUND, or FREESPACE with the first free slot, or NOSPACE.
+ */
+static uint8_t
+nbr_find(uip_ipaddr_t *ipaddr, uip_ds6_nbr_t **out)
+{
+  uip_ds6_nbr_t *nbr;
+
+  *out = NULL;
+  for(nbr = uip_ds6_nbr_cache; nbr < uip_ds6_nbr_cache + UIP_DS6_NBR_NB;
+      nbr++) {
+    if(!nbr->isused) {
+      if(*out == NULL) {
+        *out = nbr;
+      }
+    } else if(uip_ipaddr_cmp(&nbr->ipaddr, ipaddr) &&
+              uip_ds6_same_link(ipaddr, nbr->link, uip_ds6_link)) {
+      *out = nbr;
+      return FOUND;
+    }
+  }
+  return *out != NULL ? FREESPACE : NOSPACE;
+}
 /*---------------------------------------------------------------------------*/
 uip_ds6_nbr_t *
 uip_ds6_nbr_add(uip_ipaddr_t *ipaddr, uip_lladdr_t *lladdr,
@@ -292,10 +527,7 @@ uip_ds6_nbr_add(uip_ipaddr_t *ipaddr, uip_lladdr_t *lladdr,
 {
   int r;
 
-  r = uip_ds6_list_loop
-     ((uip_ds6_element_t *)uip_ds6_nbr_cache, UIP_DS6_NBR_NB,
-      sizeof(uip_ds6_nbr_t), ipaddr, 128,
-      (uip_ds6_element_t **)&locnbr);
+  r = nbr_find(ipaddr, &locnbr);
 
   if(r == FREESPACE) {
     locnbr->isused = 1;
@@ -307,6 +539,7 @@ uip_ds6_nbr_add(uip_ipaddr_t *ipaddr, uip_lladdr_t *lladdr,
     }
     locnbr->isrouter = isrouter;
     locnbr->state = state;
+    locnbr->link = uip_ds6_link;
 #if UIP_CONF_IPV6_QUEUE_PKT
     uip_packetqueue_new(&locnbr->packethandle);
 #endif /* UIP_CONF_IPV6_QUEUE_PKT */
@@ -320,32 +553,16 @@ uip_ds6_nbr_add(uip_ipaddr_t *ipaddr, uip_lladdr_t *lladdr,
     PRINTLLADDR((&(locnbr->lladdr)));
     PRINTF("state %u\n", state);
     NEIGHBOR_STATE_CHANGED(locnbr);
+    uip_ds6_nbr_schedule(locnbr);
 
-    locnbr->last_lookup = clock_time();
+    locnbr->referenced = 1;
     return locnbr;
   } else if(r == NOSPACE) {
-    /* We did not find any empty slot on the neighbor list, so we need
-       to remove one old entry to make room. */
-    uip_ds6_nbr_t *n, *oldest;
-    clock_time_t oldest_time;
-
-    oldest = NULL;
-    oldest_time = clock_time();
-
-    for(n = uip_ds6_nbr_cache;
-        n < &uip_ds6_nbr_cache[UIP_DS6_NBR_NB];
-        n++) {
-      if(n->isused) {
-        if(n->last_lookup < oldest_time) {
-          oldest = n;
-          oldest_time = n->last_lookup;
-        }
-      }
-    }
-    if(oldest != NULL) {
-      uip_ds6_nbr_rm(oldest);
+    /* No empty slot left, make room by replacing a neighbor */
+    if(nbr_evict() != NULL) {
       return uip_ds6_nbr_add(ipaddr, lladdr, isrouter, state);
     }
+    uip_ds6_nbr_stats.refused++;
   }
   PRINTF("uip_ds6_nbr_add drop\n");
   return NULL;
@@ -357,6 +574,7 @@ uip_ds6_nbr_rm(uip_ds6_nbr_t *nbr)
 {
   if(nbr != NULL) {
     nbr->isused = 0;
+    heap_remove(&nbr_heap, &nbr_expiry[nbr - uip_ds6_nbr_cache]);
 #if UIP_CONF_IPV6_QUEUE_PKT
     uip_packetqueue_free(&nbr->packethandle);
 #endif /* UIP_CONF_IPV6_QUEUE_PKT */
@@ -365,15 +583,43 @@ uip_ds6_nbr_rm(uip_ds6_nbr_t *nbr)
   return;
 }
 
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief Queue a neighbor for the periodic processing when the timer of
+ * its state runs out. To be called whenever the state, nscount or a
+ * timer of a neighbor changes; states without a timer leave the queue.
+ */
+void
+uip_ds6_nbr_schedule(uip_ds6_nbr_t *nbr)
+{
+  struct heap_node *n;
+
+  n = &nbr_expiry[nbr - uip_ds6_nbr_cache];
+  if(!nbr->isused) {
+    heap_remove(&nbr_heap, n);
+    return;
+  }
+  switch(nbr->state) {
+  case NBR_INCOMPLETE:
+  case NBR_PROBE:
+    /* The last NS also gets its retransmission time for an answer */
+    heap_set(&nbr_heap, n, clock_seconds() + stimer_remaining(&nbr->sendns));
+    break;
+  case NBR_REACHABLE:
+  case NBR_DELAY:
+    heap_set(&nbr_heap, n, clock_seconds() + stimer_remaining(&nbr->reachable));
+    break;
+  default:
+    heap_remove(&nbr_heap, n);
+    break;
+  }
+}
 /*---------------------------------------------------------------------------*/
 uip_ds6_nbr_t *
 uip_ds6_nbr_lookup(uip_ipaddr_t *ipaddr)
 {
-  if(uip_ds6_list_loop
-     ((uip_ds6_element_t *)uip_ds6_nbr_cache, UIP_DS6_NBR_NB,
-      sizeof(uip_ds6_nbr_t), ipaddr, 128,
-      (uip_ds6_element_t **)&locnbr) == FOUND) {
-    locnbr->last_lookup = clock_time();
+  if(nbr_find(ipaddr, &locnbr) == FOUND) {
+    locnbr->referenced = 1;
     return locnbr;
   }
   return NULL;
@@ -390,6 +636,7 @@ uip_ds6_nbr_ll_lookup(uip_lladdr_t *lladdr)
        ++locnbr) {
     if(locnbr->isused) {
       if(!memcmp(lladdr, &locnbr->lladdr, UIP_LLADDR_LEN)) {
+        locnbr->referenced = 1;
         return locnbr;
       }
     }
@@ -581,6 +828,7 @@ uip_ds6_addr_add(uip_ipaddr_t *ipaddr, unsigned long vlifetime, uint8_t type)
     locaddr->isused = 1;
     uip_ipaddr_copy(&locaddr->ipaddr, ipaddr);
     locaddr->type = type;
+    locaddr->link = uip_ds6_link;
     if(vlifetime == 0) {
       locaddr->isinfinite = 1;
     } else {
@@ -632,7 +880,7 @@ uip_ds6_addr_lookup(uip_ipaddr_t *ipaddr)
 
 /*---------------------------------------------------------------------------*/
 /*
- * get a link local address -
+ * get a link local address of the current link -
  * state = -1 => any address is ok. Otherwise state = desired state of addr.
  * (TENTATIVE, PREFERRED, DEPRECATED)
  */
@@ -642,6 +890,7 @@ uip_ds6_get_link_local(int8_t state)
   for(locaddr = uip_ds6_if.addr_list;
       locaddr < uip_ds6_if.addr_list + UIP_DS6_ADDR_NB; locaddr++) {
     if(locaddr->isused && (state == -1 || locaddr->state == state)
+       && locaddr->link == uip_ds6_link
        && (uip_is_addr_link_local(&locaddr->ipaddr))) {
       return locaddr;
     }
@@ -744,33 +993,308 @@ uip_ds6_aaddr_lookup(uip_ipaddr_t *ipaddr)
   return NULL;
 }
 
+/*---------------------------------------------------------------------------*/
+/* Store the key of a route, 0 when no table has room for it */
+static uint8_t
+route_target_set(uip_ds6_route_t *route, uip_ipaddr_t *ipaddr, uint8_t length)
+{
+  uint8_t unused;
+  uint8_t i;
+  uint16_t f;
+
+  if(length >= 64) {
+    unused = UIP_DS6_ROUTE_FULL;
+    for(i = 0; i < UIP_DS6_ROUTE_PREFIX_NB; i++) {
+      if(route_prefix[i].refs == 0) {
+        if(unused == UIP_DS6_ROUTE_FULL) {
+          unused = i;
+        }
+      } else if(memcmp(route_prefix[i].prefix, ipaddr, 8) == 0) {
+        break;
+      }
+    }
+    if(i == UIP_DS6_ROUTE_PREFIX_NB && unused != UIP_DS6_ROUTE_FULL) {
+      i = unused;
+      memcpy(route_prefix[i].prefix, ipaddr, 8);
+    }
+    if(i < UIP_DS6_ROUTE_PREFIX_NB) {
+      route_prefix[i].refs++;
+      route->prefix = i;
+      memcpy(route->target.iid, &ipaddr->u8[8], 8);
+      return 1;
+    }
+  }
+
+  for(f = 0; f < UIP_DS6_ROUTE_FULL_NB; f++) {
+    if(!route_full_used[f]) {
+      route_full_used[f] = 1;
+      uip_ipaddr_copy(&route_full[f], ipaddr);
+      route->prefix = UIP_DS6_ROUTE_FULL;
+      route->target.full = f;
+      return 1;
+    }
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+route_target_clear(uip_ds6_route_t *route)
+{
+  if(route->prefix == UIP_DS6_ROUTE_FULL) {
+    route_full_used[route->target.full] = 0;
+  } else {
+    route_prefix[route->prefix].refs--;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Whether the first length bits of ipaddr are those of the target */
+static uint8_t
+route_target_match(uip_ds6_route_t *route, uip_ipaddr_t *ipaddr,
+                   uint8_t length)
+{
+  if(route->prefix == UIP_DS6_ROUTE_FULL) {
+    return uip_ipaddr_prefixcmp(ipaddr, &route_full[route->target.full],
+                                length);
+  }
+  if(length < 64) {
+    return memcmp(ipaddr, route_prefix[route->prefix].prefix,
+                  length >> 3) == 0;
+  }
+  return memcmp(ipaddr, route_prefix[route->prefix].prefix, 8) == 0 &&
+    memcmp(&ipaddr->u8[8], route->target.iid, (length - 64) >> 3) == 0;
+}
+/*---------------------------------------------------------------------------*/
+/** \brief Copy the target of a route to ipaddr */
+void
+uip_ds6_route_ipaddr(uip_ds6_route_t *route, uip_ipaddr_t *ipaddr)
+{
+  if(route->prefix == UIP_DS6_ROUTE_FULL) {
+    uip_ipaddr_copy(ipaddr, &route_full[route->target.full]);
+  } else {
+    memcpy(ipaddr, route_prefix[route->prefix].prefix, 8);
+    memcpy(&ipaddr->u8[8], route->target.iid, 8);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/** \brief The next hop of a route, valid as long as the route is */
+uip_ipaddr_t *
+uip_ds6_route_nexthop(uip_ds6_route_t *route)
+{
+  return &route_nexthop[route->nexthop].ipaddr;
+}
+/*---------------------------------------------------------------------------*/
+/** \brief Link the next hop of a route is on */
+uint8_t
+uip_ds6_route_link(uip_ds6_route_t *route)
+{
+  return route_nexthop[route->nexthop].link;
+}
+/*---------------------------------------------------------------------------*/
+/** \brief Whether a route is the one to ipaddr/length */
+uint8_t
+uip_ds6_route_cmp(uip_ds6_route_t *route, uip_ipaddr_t *ipaddr,
+                  uint8_t length)
+{
+  return route->length == length && route_target_match(route, ipaddr, length);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Bucket of a target. The targets of /64 or longer mostly share their
+ * route prefix, so only the interface id bytes they cover are hashed.
+ */
+static uint16_t *
+route_head(uip_ipaddr_t *ipaddr, uint8_t length)
+{
+  uint16_t h;
+  uint8_t i;
+
+  h = length;
+  for(i = length >= 64 ? 8 : 0; i < length >> 3; i++) {
+    h = (h << 5) + h + ipaddr->u8[i];
+  }
+  return &route_bucket[(h ^ (h >> 8)) & (UIP_DS6_ROUTE_HASH - 1)];
+}
+/*---------------------------------------------------------------------------*/
+/* The target list a slot is on: its bucket when used, else the free list */
+static uint16_t *
+route_list(uip_ds6_route_t *route)
+{
+  uip_ipaddr_t ipaddr;
+
+  if(!route->isused) {
+    return &route_free_list;
+  }
+  uip_ds6_route_ipaddr(route, &ipaddr);
+  return route_head(&ipaddr, route->length);
+}
+/*---------------------------------------------------------------------------*/
+static void
+route_list_link(uip_ds6_route_t *route)
+{
+  uint16_t *head;
+  uint16_t i;
+
+  i = route - uip_ds6_routing_table;
+  head = route_list(route);
+  route_prev[i] = ROUTE_NONE;
+  route_next[i] = *head;
+  if(*head != ROUTE_NONE) {
+    route_prev[*head] = i;
+  }
+  *head = i;
+}
+/*---------------------------------------------------------------------------*/
+static void
+route_list_unlink(uip_ds6_route_t *route)
+{
+  uint16_t i;
+
+  i = route - uip_ds6_routing_table;
+  if(route_prev[i] == ROUTE_NONE) {
+    *route_list(route) = route_next[i];
+  } else {
+    route_next[route_prev[i]] = route_next[i];
+  }
+  if(route_next[i] != ROUTE_NONE) {
+    route_prev[route_next[i]] = route_prev[i];
+  }
+}
+/*---------------------------------------------------------------------------*/
+/** \brief The route to exactly ipaddr/length, NULL if there is none */
+uip_ds6_route_t *
+uip_ds6_route_find(uip_ipaddr_t *ipaddr, uint8_t length)
+{
+  uint16_t i;
+
+  for(i = *route_head(ipaddr, length); i != ROUTE_NONE; i = route_next[i]) {
+    if(uip_ds6_route_cmp(&uip_ds6_routing_table[i], ipaddr, length)) {
+      return &uip_ds6_routing_table[i];
+    }
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief Record that a route was added, removed or changed, store telling
+ * whether slot is a slot of the routing table or of another store
+ */
+void
+uip_ds6_route_log(uint8_t store, uint16_t slot, uip_ipaddr_t *ipaddr,
+                  uint8_t length)
+{
+#if UIP_DS6_ROUTE_LOG_NB
+  uip_ds6_route_change_t *change;
+
+  if(route_log_lost) {
+    /* The reader compares everything anyway */
+    return;
+  }
+  if(route_log_count == UIP_DS6_ROUTE_LOG_NB) {
+    PRINTF("DS6: Route log full\n");
+    route_log_count = 0;
+    route_log_lost = 1;
+    return;
+  }
+  change = &route_log[(route_log_head + route_log_count) %
+                      UIP_DS6_ROUTE_LOG_NB];
+  route_log_count++;
+  uip_ipaddr_copy(&change->ipaddr, ipaddr);
+  change->length = length;
+  change->store = store;
+  change->slot = slot;
+#else /* UIP_DS6_ROUTE_LOG_NB */
+  route_log_lost = 1;
+#endif /* UIP_DS6_ROUTE_LOG_NB */
+}
+/*---------------------------------------------------------------------------*/
+/** \brief Take the oldest change from the log, 0 when there is none */
+uint8_t
+uip_ds6_route_log_next(uip_ds6_route_change_t *change)
+{
+#if UIP_DS6_ROUTE_LOG_NB
+  if(route_log_count == 0) {
+    return 0;
+  }
+  memcpy(change, &route_log[route_log_head], sizeof(*change));
+  route_log_head = (route_log_head + 1) % UIP_DS6_ROUTE_LOG_NB;
+  route_log_count--;
+  return 1;
+#else /* UIP_DS6_ROUTE_LOG_NB */
+  return 0;
+#endif /* UIP_DS6_ROUTE_LOG_NB */
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief Whether changes were lost since the last call. The reader then
+ * compares all the routes and the log restarts from there.
+ */
+uint8_t
+uip_ds6_route_log_lost(void)
+{
+  if(!route_log_lost) {
+    return 0;
+  }
+  route_log_lost = 0;
+#if UIP_DS6_ROUTE_LOG_NB
+  route_log_count = 0;
+#endif /* UIP_DS6_ROUTE_LOG_NB */
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+route_log_slot(uip_ds6_route_t *route)
+{
+  uip_ipaddr_t ipaddr;
+
+  uip_ds6_route_ipaddr(route, &ipaddr);
+  uip_ds6_route_log(UIP_DS6_ROUTE_TABLE, route - uip_ds6_routing_table,
+                    &ipaddr, route->length);
+}
 /*---------------------------------------------------------------------------*/
 uip_ds6_route_t *
 uip_ds6_route_lookup(uip_ipaddr_t *destipaddr)
 {
   uip_ds6_route_t *locrt = NULL;
   uint8_t longestmatch = 0;
+  uint8_t prefix_match[UIP_DS6_ROUTE_PREFIX_NB];
+  uint8_t i;
 
   PRINTF("DS6: Looking up route for ");
   PRINT6ADDR(destipaddr);
   PRINTF("\n");
 
+  /* Compare the upper half of the destination once per route prefix,
+     the routes below a prefix then only compare interface ids */
+  for(i = 0; i < UIP_DS6_ROUTE_PREFIX_NB; i++) {
+    prefix_match[i] = route_prefix[i].refs != 0 &&
+      memcmp(route_prefix[i].prefix, destipaddr, 8) == 0;
+  }
+
   for(locroute = uip_ds6_routing_table;
       locroute < uip_ds6_routing_table + UIP_DS6_ROUTE_NB; locroute++) {
-    if((locroute->isused) && (locroute->length >= longestmatch)
-       &&
-       (uip_ipaddr_prefixcmp
-        (destipaddr, &locroute->ipaddr, locroute->length))) {
-      longestmatch = locroute->length;
-      locrt = locroute;
+    if(!locroute->isused || locroute->length < longestmatch) {
+      continue;
     }
+    if(locroute->prefix == UIP_DS6_ROUTE_FULL) {
+      if(!uip_ipaddr_prefixcmp(destipaddr,
+                               &route_full[locroute->target.full],
+                               locroute->length)) {
+        continue;
+      }
+    } else if(!prefix_match[locroute->prefix] ||
+              memcmp(&destipaddr->u8[8], locroute->target.iid,
+                     (locroute->length - 64) >> 3) != 0) {
+      continue;
+    }
+    longestmatch = locroute->length;
+    locrt = locroute;
   }
 
   if(locrt != NULL) {
     PRINTF("DS6: Found route:");
     PRINT6ADDR(destipaddr);
     PRINTF(" via ");
-    PRINT6ADDR(&locrt->nexthop);
+    PRINT6ADDR(uip_ds6_route_nexthop(locrt));
     PRINTF("\n");
   } else {
     PRINTF("DS6: No route found\n");
@@ -779,65 +1303,249 @@ uip_ds6_route_lookup(uip_ipaddr_t *destipaddr)
   return locrt;
 }
 
+/*---------------------------------------------------------------------------*/
+static uint16_t *
+nexthop_head(uip_ipaddr_t *nexthop)
+{
+  return &nexthop_bucket[(nexthop->u8[12] ^ nexthop->u8[13] ^
+                          nexthop->u8[14] ^ nexthop->u8[15]) &
+                         (UIP_DS6_ROUTE_NEXTHOP_HASH - 1)];
+}
+/*---------------------------------------------------------------------------*/
+/* Slot of a next hop on a link, added when add is set; ROUTE_NONE if none */
+static uint16_t
+nexthop_get(uip_ipaddr_t *nexthop, uint8_t link, uint8_t add)
+{
+  uint16_t *head;
+  uint16_t i;
+
+  head = nexthop_head(nexthop);
+  for(i = *head; i != ROUTE_NONE; i = route_nexthop[i].next) {
+    if(uip_ipaddr_cmp(&route_nexthop[i].ipaddr, nexthop) &&
+       uip_ds6_same_link(nexthop, route_nexthop[i].link, link)) {
+      return i;
+    }
+  }
+  if(!add || nexthop_free == ROUTE_NONE) {
+    return ROUTE_NONE;
+  }
+  i = nexthop_free;
+  nexthop_free = route_nexthop[i].next;
+  uip_ipaddr_copy(&route_nexthop[i].ipaddr, nexthop);
+  route_nexthop[i].link = link;
+  route_nexthop[i].routes = ROUTE_NONE;
+  route_nexthop[i].next = *head;
+  *head = i;
+  return i;
+}
+/*---------------------------------------------------------------------------*/
+/* Free a next hop once no route goes through it */
+static void
+nexthop_put(uint16_t i)
+{
+  uint16_t *p;
+
+  if(route_nexthop[i].routes != ROUTE_NONE) {
+    return;
+  }
+  for(p = nexthop_head(&route_nexthop[i].ipaddr); *p != i;
+      p = &route_nexthop[*p].next);
+  *p = route_nexthop[i].next;
+  route_nexthop[i].next = nexthop_free;
+  nexthop_free = i;
+}
+/*---------------------------------------------------------------------------*/
+static void
+nexthop_link(uip_ds6_route_t *route)
+{
+  uint16_t *head;
+  uint16_t i;
+
+  i = route - uip_ds6_routing_table;
+  head = &route_nexthop[route->nexthop].routes;
+  nexthop_prev[i] = ROUTE_NONE;
+  nexthop_next[i] = *head;
+  if(*head != ROUTE_NONE) {
+    nexthop_prev[*head] = i;
+  }
+  *head = i;
+}
+/*---------------------------------------------------------------------------*/
+static void
+nexthop_unlink(uip_ds6_route_t *route)
+{
+  uint16_t i;
+
+  i = route - uip_ds6_routing_table;
+  if(nexthop_prev[i] == ROUTE_NONE) {
+    route_nexthop[route->nexthop].routes = nexthop_next[i];
+  } else {
+    nexthop_next[nexthop_prev[i]] = nexthop_next[i];
+  }
+  if(nexthop_next[i] != ROUTE_NONE) {
+    nexthop_prev[nexthop_next[i]] = nexthop_prev[i];
+  }
+  nexthop_put(route->nexthop);
+}
+/*---------------------------------------------------------------------------*/
+static uip_ds6_route_t *
+nexthop_first(uip_ipaddr_t *nexthop, uint8_t link)
+{
+  uint16_t i;
+
+  i = nexthop_get(nexthop, link, 0);
+  if(i == ROUTE_NONE) {
+    return NULL;
+  }
+  return &uip_ds6_routing_table[route_nexthop[i].routes];
+}
+/*---------------------------------------------------------------------------*/
+/** \brief First route through nexthop on the current link, NULL if
+ *  there is none */
+uip_ds6_route_t *
+uip_ds6_route_nexthop_first(uip_ipaddr_t *nexthop)
+{
+  return nexthop_first(nexthop, uip_ds6_link);
+}
+/*---------------------------------------------------------------------------*/
+/** \brief Next route through the same next hop as route */
+uip_ds6_route_t *
+uip_ds6_route_nexthop_next(uip_ds6_route_t *route)
+{
+  uint16_t i;
+
+  i = nexthop_next[route - uip_ds6_routing_table];
+  return i == ROUTE_NONE ? NULL : &uip_ds6_routing_table[i];
+}
+/*---------------------------------------------------------------------------*/
+/** \brief Move a route to another next hop, 0 if the next hop table
+ *  is full; the route then keeps its next hop */
+uint8_t
+uip_ds6_route_set_nexthop(uip_ds6_route_t *route, uip_ipaddr_t *nexthop)
+{
+  uint16_t i;
+
+  i = nexthop_get(nexthop, uip_ds6_link, 1);
+  if(i == ROUTE_NONE) {
+    PRINTF("DS6: No space for more next hops\n");
+    return 0;
+  }
+  if(i == route->nexthop) {
+    return 1;
+  }
+  nexthop_unlink(route);
+  route->nexthop = i;
+  nexthop_link(route);
+  route_log_slot(route);
+  return 1;
+}
 /*---------------------------------------------------------------------------*/
 uip_ds6_route_t *
 uip_ds6_route_add(uip_ipaddr_t *ipaddr, uint8_t length, uip_ipaddr_t *nexthop,
                   uint8_t metric)
 {
-  if(uip_ds6_list_loop
-     ((uip_ds6_element_t *)uip_ds6_routing_table, UIP_DS6_ROUTE_NB,
-      sizeof(uip_ds6_route_t), ipaddr, length,
-      (uip_ds6_element_t **)&locroute) == FREESPACE) {
-    locroute->isused = 1;
-    uip_ipaddr_copy(&(locroute->ipaddr), ipaddr);
-    locroute->length = length;
-    uip_ipaddr_copy(&(locroute->nexthop), nexthop);
-    locroute->metric = metric;
+  locroute = uip_ds6_route_find(ipaddr, length);
+  if(locroute != NULL) {
+    return locroute;
+  }
 
-#ifdef UIP_DS6_ROUTE_STATE_TYPE
-    memset(&locroute->state, 0, sizeof(UIP_DS6_ROUTE_STATE_TYPE));
-#endif
+  if(route_free_list == ROUTE_NONE) {
+    return NULL;
+  }
+  locroute = &uip_ds6_routing_table[route_free_list];
+  if(!uip_ds6_route_set(locroute, ipaddr, length, nexthop, metric)) {
+    return NULL;
+  }
+  return locroute;
+}
+/*---------------------------------------------------------------------------*/
+static void
+route_free(uip_ds6_route_t *route)
+{
+  route_log_slot(route);
+  nexthop_unlink(route);
+  ROUTE_REMOVED(route);
+  route_list_unlink(route);
+  route_target_clear(route);
+  route->isused = 0;
+  route_list_link(route);
+}
+/*---------------------------------------------------------------------------*/
+/** \brief Store a route in the given slot, 0 if its target or its next
+ *  hop found no room; the slot is then left unused */
+uint8_t
+uip_ds6_route_set(uip_ds6_route_t *route, uip_ipaddr_t *ipaddr,
+                  uint8_t length, uip_ipaddr_t *nexthop, uint8_t metric)
+{
+  uint16_t i;
 
-    PRINTF("DS6: adding route: ");
-    PRINT6ADDR(ipaddr);
-    PRINTF(" via ");
-    PRINT6ADDR(nexthop);
-    PRINTF("\n");
-    ANNOTATE("#L %u 1;blue\n", nexthop->u8[sizeof(uip_ipaddr_t) - 1]);
+  if(route->isused) {
+    route_free(route);
   }
 
-  return locroute;
+  i = nexthop_get(nexthop, uip_ds6_link, 1);
+  if(i == ROUTE_NONE) {
+    PRINTF("DS6: No space for more next hops\n");
+    return 0;
+  }
+  if(!route_target_set(route, ipaddr, length)) {
+    PRINTF("DS6: No space for the route key\n");
+    nexthop_put(i);
+    return 0;
+  }
+  route_list_unlink(route);
+  route->isused = 1;
+  route->length = length;
+  route_list_link(route);
+  route->nexthop = i;
+  nexthop_link(route);
+  route->metric = metric;
+  route_log_slot(route);
+
+#ifdef UIP_DS6_ROUTE_STATE_TYPE
+  memset(&route->state, 0, sizeof(UIP_DS6_ROUTE_STATE_TYPE));
+#endif
+
+  PRINTF("DS6: adding route: ");
+  PRINT6ADDR(ipaddr);
+  PRINTF(" via ");
+  PRINT6ADDR(nexthop);
+  PRINTF("\n");
+  ANNOTATE("#L %u 1;blue\n", nexthop->u8[sizeof(uip_ipaddr_t) - 1]);
+  return 1;
 }
 
 /*---------------------------------------------------------------------------*/
 void
 uip_ds6_route_rm(uip_ds6_route_t *route)
 {
-  route->isused = 0;
 #if (DEBUG & DEBUG_ANNOTATE) == DEBUG_ANNOTATE
-  /* we need to check if this was the last route towards "nexthop" */
-  /* if so - remove that link (annotation) */
-  for(locroute = uip_ds6_routing_table;
-      locroute < uip_ds6_routing_table + UIP_DS6_ROUTE_NB;
-      locroute++) {
-    if(locroute->isused && uip_ipaddr_cmp(&locroute->nexthop, &route->nexthop))      {
-      /* we found another link using the specific nexthop, so keep the #L */
-      return;
-    }
+  uip_ipaddr_t *nexthop;
+#endif
+
+  if(!route->isused) {
+    return;
+  }
+#if (DEBUG & DEBUG_ANNOTATE) == DEBUG_ANNOTATE
+  /* Remove the link (annotation) with the last route towards "nexthop" */
+  nexthop = uip_ds6_route_nexthop(route);
+  if(uip_ds6_route_nexthop_first(nexthop) == route &&
+     uip_ds6_route_nexthop_next(route) == NULL) {
+    ANNOTATE("#L %u 0\n", nexthop->u8[sizeof(uip_ipaddr_t) - 1]);
   }
-  ANNOTATE("#L %u 0\n",route->nexthop.u8[sizeof(uip_ipaddr_t) - 1]);
 #endif
+  route_free(route);
 }
 /*---------------------------------------------------------------------------*/
 void
 uip_ds6_route_rm_by_nexthop(uip_ipaddr_t *nexthop)
 {
-  for(locroute = uip_ds6_routing_table;
-      locroute < uip_ds6_routing_table + UIP_DS6_ROUTE_NB;
-      locroute++) {
-    if(locroute->isused && uip_ipaddr_cmp(&locroute->nexthop, nexthop)) {
-      locroute->isused = 0;
-    }
+  uip_ds6_route_t *next;
+
+  for(locroute = uip_ds6_route_nexthop_first(nexthop); locroute != NULL;
+      locroute = next) {
+    next = uip_ds6_route_nexthop_next(locroute);
+    route_free(locroute);
   }
   ANNOTATE("#L %u 0\n",nexthop->u8[sizeof(uip_ipaddr_t) - 1]);
 }
@@ -126,6 +126,13 @@
 #endif
 #define UIP_DS6_AADDR_NB UIP_DS6_AADDR_NBS + UIP_DS6_AADDR_NBU
 
+/* Links served at once, see uip_ds6_set_link() */
+#ifndef UIP_CONF_DS6_LINK_NB
+#define UIP_DS6_LINK_NB 1
+#else
+#define UIP_DS6_LINK_NB UIP_CONF_DS6_LINK_NB
+#endif
+
 /*--------------------------------------------------*/
 /* Should we use LinkLayer acks in NUD ?*/
 #ifndef UIP_CONF_DS6_LL_NUD
@@ -171,7 +178,8 @@ typedef struct uip_ds6_nbr {
   uip_lladdr_t lladdr;
   struct stimer reachable;
   struct stimer sendns;
-  clock_time_t last_lookup;
+  uint8_t referenced;           /**< Looked up since the clock hand passed */
+  uint8_t link;                 /**< Link the neighbor was seen on */
   uint8_t nscount;
   uint8_t isrouter;
   uint8_t state;
@@ -181,6 +189,13 @@ typedef struct uip_ds6_nbr {
 #endif                          /*UIP_CONF_QUEUE_PKT */
 } uip_ds6_nbr_t;
 
+/** \brief Neighbor cache replacement counters */
+typedef struct uip_ds6_nbr_stats {
+  uint32_t evicted;             /**< Entries replaced by a new neighbor */
+  uint32_t evicted_stale;       /**< Of which STALE non-routers */
+  uint32_t refused;             /**< New neighbors dropped, none evictable */
+} uip_ds6_nbr_stats_t;
+
 /** \brief An entry in the default router list */
 typedef struct uip_ds6_defrt {
   uint8_t isused;
@@ -217,6 +232,7 @@ typedef struct uip_ds6_addr {
   uint8_t state;
   uint8_t type;
   uint8_t isinfinite;
+  uint8_t link;                 /**< Link the address is assigned on */
   struct stimer vlifetime;
 #if UIP_ND6_DEF_MAXDADNS > 0
   struct timer dadtimer;
@@ -242,10 +258,12 @@ typedef struct uip_ds6_maddr {
 #define UIP_DS6_ROUTE_STATE_TYPE rpl_route_entry_t
 /* Needed for the extended route entry state when using ContikiRPL */
 typedef struct rpl_route_entry {
-  uint32_t lifetime;
+  uint32_t expires; /* clock_seconds() deadline, see rpl_route_set_lifetime() */
   uint32_t saved_lifetime;
   void *dag;
   uint8_t learned_from;
+  uint8_t path_sequence;
+  uint8_t stale;
 } rpl_route_entry_t;
 #endif /* UIP_DS6_ROUTE_STATE_TYPE */
 
@@ -254,17 +272,85 @@ typedef struct rpl_route_entry {
 #ifndef UIP_CONF_DS6_NEIGHBOR_STATE_CHANGED
 #define UIP_CONF_DS6_NEIGHBOR_STATE_CHANGED rpl_ipv6_neighbor_callback
 #endif /* UIP_CONF_DS6_NEIGHBOR_STATE_CHANGED */
+#ifndef UIP_CONF_DS6_ROUTE_REMOVED
+#define UIP_CONF_DS6_ROUTE_REMOVED rpl_route_removed
+#endif /* UIP_CONF_DS6_ROUTE_REMOVED */
 #endif /* UIP_CONF_IPV6_RPL */
 
+/* Buckets of the next hop index of the routing table, a power of two */
+#ifdef UIP_CONF_DS6_ROUTE_NEXTHOP_HASH
+#define UIP_DS6_ROUTE_NEXTHOP_HASH UIP_CONF_DS6_ROUTE_NEXTHOP_HASH
+#else
+#define UIP_DS6_ROUTE_NEXTHOP_HASH 64
+#endif
+
+/* Buckets of the target index of the routing table, a power of two */
+#ifdef UIP_CONF_DS6_ROUTE_HASH
+#define UIP_DS6_ROUTE_HASH UIP_CONF_DS6_ROUTE_HASH
+#else
+#define UIP_DS6_ROUTE_HASH 64
+#endif
+
+/* Distinct next hops of the routing table */
+#ifdef UIP_CONF_DS6_ROUTE_NEXTHOP_NB
+#define UIP_DS6_ROUTE_NEXTHOP_NB UIP_CONF_DS6_ROUTE_NEXTHOP_NB
+#else
+#define UIP_DS6_ROUTE_NEXTHOP_NB (UIP_DS6_NBR_NB)
+#endif
+
+/* /64 prefixes under which route targets are kept as interface ids */
+#ifdef UIP_CONF_DS6_ROUTE_PREFIX_NB
+#define UIP_DS6_ROUTE_PREFIX_NB UIP_CONF_DS6_ROUTE_PREFIX_NB
+#else
+#define UIP_DS6_ROUTE_PREFIX_NB 4
+#endif
+
+/* Route targets kept as full addresses, shorter than /64 or outside
+   the route prefixes */
+#ifdef UIP_CONF_DS6_ROUTE_FULL_NB
+#define UIP_DS6_ROUTE_FULL_NB UIP_CONF_DS6_ROUTE_FULL_NB
+#else
+#define UIP_DS6_ROUTE_FULL_NB 8
+#endif
+
+/* Value of uip_ds6_route_t.prefix for a target kept as a full address */
+#define UIP_DS6_ROUTE_FULL 0xff
 
+/* Entries of the route change log, 0 to keep none */
+#ifdef UIP_CONF_DS6_ROUTE_LOG_NB
+#define UIP_DS6_ROUTE_LOG_NB UIP_CONF_DS6_ROUTE_LOG_NB
+#else
+#define UIP_DS6_ROUTE_LOG_NB 0
+#endif
+
+/* Stores a route change refers to */
+#define UIP_DS6_ROUTE_TABLE 0   /**< The routing table */
+#define UIP_DS6_ROUTE_SRCRT 1   /**< The source routed targets of RPL */
+
+/** \brief A route added, removed or changed. The slot tells where the
+ *  route was in its store; the route is gone when the slot is free or
+ *  holds another target by the time the change is read. */
+typedef struct uip_ds6_route_change {
+  uip_ipaddr_t ipaddr;
+  uint8_t length;
+  uint8_t store;
+  uint16_t slot;
+} uip_ds6_route_change_t;
 
-/** \brief An entry in the routing table */
+/** \brief An entry in the routing table. The target and the next hop
+ *  are kept in shared tables, see uip_ds6_route_ipaddr() and
+ *  uip_ds6_route_nexthop() */
 typedef struct uip_ds6_route {
   uint8_t isused;
-  uip_ipaddr_t ipaddr;
   uint8_t length;
   uint8_t metric;
-  uip_ipaddr_t nexthop;
+  uint8_t prefix;               /**< Route prefix of the target, or
+                                     UIP_DS6_ROUTE_FULL */
+  uint16_t nexthop;             /**< Slot in the next hop table */
+  union {
+    uint8_t iid[8];             /**< Target below its route prefix */
+    uint16_t full;              /**< Slot in the full target table */
+  } target;
 #ifdef UIP_DS6_ROUTE_STATE_TYPE
   UIP_DS6_ROUTE_STATE_TYPE state;
 #endif
@@ -292,8 +378,11 @@ typedef struct uip_ds6_element {
 
 /*---------------------------------------------------------------------------*/
 extern uip_ds6_netif_t uip_ds6_if;
+extern uip_ds6_nbr_stats_t uip_ds6_nbr_stats;
+extern uint8_t uip_ds6_link;
 extern struct etimer uip_ds6_timer_periodic;
 
+
 #if UIP_CONF_ROUTER
 extern uip_ds6_prefix_t uip_ds6_prefix_list[UIP_DS6_PREFIX_NB];
 #else /* UIP_CONF_ROUTER */
@@ -308,9 +397,27 @@ void uip_ds6_init(void);
 /** \brief Periodic processing of data structures */
 void uip_ds6_periodic(void);
 
+/**
+ * \brief Select the link the next packets are sent on
+ *
+ * uIP holds a single interface; a host serving several links tells it
+ * which one a packet belongs to. Neighbors and addresses added from now
+ * on are bound to this link, and link-local sources are taken from it.
+ * The drivers set it on input, tcpip_ipv6_output() on output to a
+ * neighbor, the callers of uip_icmp6_send() for multicasts.
+ */
+void uip_ds6_set_link(uint8_t link);
+
+/**
+ * \brief Whether an address held for link held names the same node on
+ * link: link-local addresses are only unique on their own link.
+ */
+#define uip_ds6_same_link(addr, held, link) \
+  (!uip_is_addr_link_local(addr) || (held) == (link))
+
 /** \brief Generic loop routine on an abstract data structure, which generalizes
  * all data structures used in DS6 */
-uint8_t uip_ds6_list_loop(uip_ds6_element_t *list, uint8_t size,
+uint8_t uip_ds6_list_loop(uip_ds6_element_t *list, uint16_t size,
                           uint16_t elementsize, uip_ipaddr_t *ipaddr,
                           uint8_t ipaddrlen,
                           uip_ds6_element_t **out_element);
@@ -320,6 +427,7 @@ uint8_t uip_ds6_list_loop(uip_ds6_element_t *list, uint8_t size,
 uip_ds6_nbr_t *uip_ds6_nbr_add(uip_ipaddr_t *ipaddr, uip_lladdr_t *lladdr,
                                uint8_t isrouter, uint8_t state);
 void uip_ds6_nbr_rm(uip_ds6_nbr_t *nbr);
+void uip_ds6_nbr_schedule(uip_ds6_nbr_t *nbr);
 uip_ds6_nbr_t *uip_ds6_nbr_lookup(uip_ipaddr_t *ipaddr);
 uip_ds6_nbr_t *uip_ds6_nbr_ll_lookup(uip_lladdr_t *lladdr);
 
@@ -384,10 +492,32 @@ uip_ds6_aaddr_t *uip_ds6_aaddr_lookup(uip_ipaddr_t *ipaddr);
 /** \name Routing Table basic routines */
 /** @{ */
 uip_ds6_route_t *uip_ds6_route_lookup(uip_ipaddr_t *destipaddr);
+uip_ds6_route_t *uip_ds6_route_find(uip_ipaddr_t *ipaddr, uint8_t length);
 uip_ds6_route_t *uip_ds6_route_add(uip_ipaddr_t *ipaddr, uint8_t length,
                                    uip_ipaddr_t *next_hop, uint8_t metric);
+uint8_t uip_ds6_route_set(uip_ds6_route_t *route, uip_ipaddr_t *ipaddr,
+                          uint8_t length, uip_ipaddr_t *next_hop,
+                          uint8_t metric);
 void uip_ds6_route_rm(uip_ds6_route_t *route);
 void uip_ds6_route_rm_by_nexthop(uip_ipaddr_t *nexthop);
+uint8_t uip_ds6_route_set_nexthop(uip_ds6_route_t *route,
+                                  uip_ipaddr_t *nexthop);
+void uip_ds6_route_ipaddr(uip_ds6_route_t *route, uip_ipaddr_t *ipaddr);
+uip_ipaddr_t *uip_ds6_route_nexthop(uip_ds6_route_t *route);
+uint8_t uip_ds6_route_link(uip_ds6_route_t *route);
+uint8_t uip_ds6_route_cmp(uip_ds6_route_t *route, uip_ipaddr_t *ipaddr,
+                          uint8_t length);
+uip_ds6_route_t *uip_ds6_route_nexthop_first(uip_ipaddr_t *nexthop);
+uip_ds6_route_t *uip_ds6_route_nexthop_next(uip_ds6_route_t *route);
+
+/** @} */
+
+/** \name Route change log, for code mirroring the routes elsewhere */
+/** @{ */
+void uip_ds6_route_log(uint8_t store, uint16_t slot, uip_ipaddr_t *ipaddr,
+                       uint8_t length);
+uint8_t uip_ds6_route_log_next(uip_ds6_route_change_t *change);
+uint8_t uip_ds6_route_log_lost(void);
 
 /** @} */
 
@@ -485,6 +485,7 @@ uip_nd6_na_input(void)
         nbr->state = NBR_STALE;
       }
       nbr->isrouter = is_router;
+      uip_ds6_nbr_schedule(nbr);
     } else {
       if(!is_override && is_llchange) {
         if(nbr->state == NBR_REACHABLE) {
@@ -507,6 +508,7 @@ uip_nd6_na_input(void)
               nbr->state = NBR_STALE;
             }
           }
+          uip_ds6_nbr_schedule(nbr);
         }
       }
       if(nbr->isrouter && !is_router) {
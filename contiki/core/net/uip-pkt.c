@@ -0,0 +1,94 @@
+/**
+ * \addtogroup uip6
+ * @{
+ */
+
+/**
+ * \file
+ *         Packet descriptor pool
+ */
+
+#include <string.h>
+
+#include "net/uip.h"
+#include "net/uip-pkt.h"
+
+#include "lib/memb.h"
+
+MEMB(pkt_memb, struct uip_pkt, UIP_PKT_NUM);
+static int pkt_used;
+
+#define DEBUG 0
+#if DEBUG
+#include <stdio.h>
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+/*---------------------------------------------------------------------------*/
+struct uip_pkt *
+uip_pkt_alloc(void)
+{
+  struct uip_pkt *pkt;
+
+  pkt = memb_alloc(&pkt_memb);
+  if(pkt == NULL) {
+    PRINTF("uip_pkt_alloc: pool exhausted\n");
+    return NULL;
+  }
+  pkt_used++;
+  pkt->next = NULL;
+  pkt->len = 0;
+  pkt->saved_buf = NULL;
+  return pkt;
+}
+/*---------------------------------------------------------------------------*/
+void
+uip_pkt_free(struct uip_pkt *pkt)
+{
+  if(pkt != NULL && memb_free(&pkt_memb, pkt) == 0) {
+    pkt_used--;
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+uip_pkt_available(void)
+{
+  return UIP_PKT_NUM - pkt_used;
+}
+/*---------------------------------------------------------------------------*/
+struct uip_pkt *
+uip_pkt_save(void)
+{
+  struct uip_pkt *pkt;
+
+  pkt = uip_pkt_alloc();
+  if(pkt != NULL) {
+    memcpy(pkt->buf.u8, uip_buf, UIP_LLH_LEN + uip_len);
+    pkt->len = uip_len;
+  }
+  return pkt;
+}
+/*---------------------------------------------------------------------------*/
+#if UIP_CONF_BUFFER_POINTER
+void
+uip_pkt_enter(struct uip_pkt *pkt)
+{
+  pkt->saved_buf = uip_bufptr;
+  pkt->saved_len = uip_len;
+  uip_bufptr = &pkt->buf;
+  uip_len = pkt->len;
+}
+/*---------------------------------------------------------------------------*/
+void
+uip_pkt_leave(struct uip_pkt *pkt)
+{
+  pkt->len = uip_len;
+  uip_bufptr = pkt->saved_buf;
+  uip_len = pkt->saved_len;
+  pkt->saved_buf = NULL;
+}
+#endif /* UIP_CONF_BUFFER_POINTER */
+/*---------------------------------------------------------------------------*/
+/** @} */
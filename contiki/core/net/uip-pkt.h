@@ -0,0 +1,60 @@
+/**
+ * \addtogroup uip6
+ * @{
+ */
+
+/**
+ * \file
+ *         Packet descriptors: a pool of packet buffers uIP can be pointed at
+ *
+ *         A descriptor holds one packet, link layer header included, with
+ *         the same length convention as uip_len. Drivers use descriptors
+ *         to queue received frames and hold frames waiting to be sent;
+ *         protocol code uses one to build a packet without overwriting
+ *         the packet being processed.
+ */
+
+#ifndef UIP_PKT_H
+#define UIP_PKT_H
+
+#include "net/uip.h"
+
+#ifdef UIP_CONF_PKT_NUM
+#define UIP_PKT_NUM UIP_CONF_PKT_NUM
+#else
+#define UIP_PKT_NUM 8
+#endif
+
+struct uip_pkt {
+  struct uip_pkt *next;
+  uint16_t len;                 /**< Length of the packet, as uip_len */
+  uip_buf_t *saved_buf;         /**< Buffer active before uip_pkt_enter() */
+  uint16_t saved_len;
+  uip_buf_t buf;
+};
+
+/** Get an empty descriptor, NULL when the pool is exhausted */
+struct uip_pkt *uip_pkt_alloc(void);
+
+/** Return a descriptor to the pool */
+void uip_pkt_free(struct uip_pkt *pkt);
+
+/** Number of descriptors left in the pool */
+int uip_pkt_available(void);
+
+/** Copy the packet in uip_buf into a new descriptor */
+struct uip_pkt *uip_pkt_save(void);
+
+#if UIP_CONF_BUFFER_POINTER
+/**
+ * Make the descriptor the packet uIP works on. uip_buf and uip_len
+ * refer to it until uip_pkt_leave(), which stores uip_len back in the
+ * descriptor and returns to the previous packet.
+ */
+void uip_pkt_enter(struct uip_pkt *pkt);
+void uip_pkt_leave(struct uip_pkt *pkt);
+#endif /* UIP_CONF_BUFFER_POINTER */
+
+#endif /* UIP_PKT_H */
+
+/** @} */
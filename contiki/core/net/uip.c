@@ -128,6 +128,9 @@ struct uip_eth_addr uip_ethaddr = {{0,0,0,0,0,0}};
 
 /* The packet buffer that contains incoming packets. */
 uip_buf_t uip_aligned_buf;
+#if UIP_CONF_BUFFER_POINTER
+uip_buf_t *uip_bufptr = &uip_aligned_buf;
+#endif /* UIP_CONF_BUFFER_POINTER */
 
 void *uip_appdata;               /* The uip_appdata pointer points to
 				    application data. */
@@ -483,7 +483,17 @@ typedef union {
 } uip_buf_t;
 
 CCIF extern uip_buf_t uip_aligned_buf;
+#if UIP_CONF_BUFFER_POINTER
+/*
+ * The driver may point uIP at a buffer of its own (for instance the
+ * slot a frame was received into) instead of copying the frame. It
+ * must point it back to uip_aligned_buf once the frame is processed.
+ */
+CCIF extern uip_buf_t *uip_bufptr;
+#define uip_buf (uip_bufptr->u8)
+#else /* UIP_CONF_BUFFER_POINTER */
 #define uip_buf (uip_aligned_buf.u8)
+#endif /* UIP_CONF_BUFFER_POINTER */
 
 
 /** @} */
@@ -167,6 +167,10 @@ uint8_t uip_ext_opt_offset = 0;
 #ifndef UIP_CONF_EXTERNAL_BUFFER
 uip_buf_t uip_aligned_buf;
 #endif /* UIP_CONF_EXTERNAL_BUFFER */
+#if UIP_CONF_BUFFER_POINTER
+/** Buffer uIP is currently working on, see uip.h */
+uip_buf_t *uip_bufptr = &uip_aligned_buf;
+#endif /* UIP_CONF_BUFFER_POINTER */
 
 /* The uip_appdata pointer points to application data. */
 void *uip_appdata;
@@ -10,15 +10,21 @@
  *
  */
 
+#define _GNU_SOURCE               /* for recvmmsg(), sendmmsg() and CPU affinity */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include <linux/if_packet.h>
 #include <linux/if_ether.h>
@@ -27,8 +33,21 @@
 #include <arpa/inet.h>
 
 #include "contiki-net.h"
+#include "net/uip-pkt.h"
+#include "lib/list.h"
+#include "lib/ringbuf.h"
+
+#if !UIP_CONF_BUFFER_POINTER
+#error "this driver needs UIP_CONF_BUFFER_POINTER"
+#endif
 
 #include "ethdev.h"
+#include "txqueue.h"
+
+/* Every link holds a batch of receive slots, with room left to send */
+#if UIP_PKT_NUM <= UIP_DS6_LINK_NB * NETDRV_BATCH
+#error "UIP_CONF_PKT_NUM too small for the receive slots of every link"
+#endif
 
 #define BUF ((struct ethhdr *)&uip_buf[0])
 #define IPBUF ((struct ip6_hdr *)&uip_buf[ETH_HLEN])
@@ -38,11 +57,114 @@
  */
 process_event_t ethnet_event;
 
+/* CPU the receive thread is pinned to, -1 to receive from the main loop */
+int ethdev_rx_cpu = -1;
+
+/* Deepest the receive thread's queue got */
+int ethdev_rx_peak;
+
 /***********************************************************************************
  * LOCAL DATA
  */
-static struct interface *iface;
 static uint8_t output(uip_lladdr_t *dst);
+static void rx_thread_start(void);
+
+/*
+ * One device per interface served, indexed by uIP link. Receive slots
+ * are filled by one recvmmsg() per wakeup; each slot is a packet
+ * descriptor that is queued as is and handed to uIP in place.
+ */
+struct ethdev {
+  struct interface   *iface;
+  struct uip_pkt     *rx_pkt[NETDRV_BATCH];
+  struct sockaddr_ll  rx_saddr[NETDRV_BATCH];
+  struct iovec        rx_iov[NETDRV_BATCH];
+  struct mmsghdr      rx_msg[NETDRV_BATCH];
+
+  /* Transmit queue, drained at the end of each burst and on EPOLLOUT */
+  struct txqueue      txq;
+  struct sockaddr_ll  tx_saddr;
+};
+static struct ethdev devs[UIP_DS6_LINK_NB];
+LIST(rx_queue);
+
+/* All the sockets share one epoll set, and so one event loop */
+static int epfd = -1;
+
+/*
+ * With a receive thread, frames are read into the slots of a static
+ * pool instead of packet descriptors. The thread passes the slots it
+ * filled on the full ring and the main loop gives them back on the
+ * free ring once uIP is done with them; each ring has one writer and
+ * one reader. Slots the thread took but did not fill, or filled with a
+ * frame it rejected, stay in its own stash for the next read. The
+ * thread has its own epoll set for the sockets and wakes the main loop
+ * through an eventfd in the shared one.
+ */
+#define RX_RING_SIZE  128
+
+#if ETHDEV_RX_FRAMES >= RX_RING_SIZE
+#error "ETHDEV_RX_FRAMES must fit in the receive rings"
+#endif
+
+struct rxframe {
+  struct ethdev      *dev;
+  struct uip_pkt      pkt;
+};
+static struct rxframe rx_frames[ETHDEV_RX_FRAMES];
+static uint8_t rx_full_data[RX_RING_SIZE];
+static uint8_t rx_free_data[RX_RING_SIZE];
+static struct ringbuf rx_full;
+static struct ringbuf rx_free;
+static int rx_event = -1;
+static int rx_epfd = -1;
+static pthread_t rx_thread;
+
+/* Receive vectors, only touched by the thread */
+static int                rx_slot[NETDRV_BATCH];
+static int                rx_stash[NETDRV_BATCH];
+static int                rx_nstash;
+static struct sockaddr_ll rx_saddr[NETDRV_BATCH];
+static struct iovec       rx_iov[NETDRV_BATCH];
+static struct mmsghdr     rx_msg[NETDRV_BATCH];
+
+/*----------------------------------------------------------------------*/
+static void
+init_vectors(struct ethdev *dev)
+{
+  int i;
+
+  memset(dev->rx_msg, 0, sizeof(dev->rx_msg));
+  for (i=0; i<NETDRV_BATCH; i++) {
+    dev->rx_iov[i].iov_len = UIP_BUFSIZE;
+    dev->rx_msg[i].msg_hdr.msg_iov = &dev->rx_iov[i];
+    dev->rx_msg[i].msg_hdr.msg_iovlen = 1;
+    dev->rx_msg[i].msg_hdr.msg_name = &dev->rx_saddr[i];
+  }
+}
+
+/*----------------------------------------------------------------------*/
+/*
+ * Give a descriptor to every slot that handed its own to the receive
+ * queue. Returns the number of slots, from the first, ready to receive.
+ */
+static int
+refill(struct ethdev *dev)
+{
+  int i;
+
+  for (i=0; i<NETDRV_BATCH; i++) {
+    if (dev->rx_pkt[i] == NULL) {
+      dev->rx_pkt[i] = uip_pkt_alloc();
+      if (dev->rx_pkt[i] == NULL) {
+        break;
+      }
+      dev->rx_iov[i].iov_base = dev->rx_pkt[i]->buf.u8;
+    }
+    dev->rx_msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+  }
+  return i;
+}
 
 /*----------------------------------------------------------------------*/
 static void
@@ -51,6 +173,10 @@ setoutput(void)
   process_start(&ethdev_process, NULL);
 
   tcpip_set_outputfunc(output);
+
+  if (rx_epfd >= 0) {
+    rx_thread_start();
+  }
 }
 
 /*----------------------------------------------------------------------*/
@@ -59,11 +185,19 @@ setup(struct interface *ni)
 {
   int nd_socket;
   int verbose = ni->verbose;
+  struct epoll_event ev;
+  struct ethdev *dev;
 
   if (verbose) {
     fprintf(stderr, "setting up %s\n", ni->name);
   }
 
+  if (ni->link < 0 || ni->link >= UIP_DS6_LINK_NB) {
+    fprintf(stderr, "%s is not attached to a link\n", ni->name);
+    return -1;
+  }
+  dev = &devs[ni->link];
+
   nd_socket = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
 
   if (nd_socket < 0) {
@@ -72,29 +206,88 @@ setup(struct interface *ni)
   }
 
   ni->nd_socket = nd_socket;
-  iface = ni;
+  dev->iface = ni;
+  init_vectors(dev);
+  list_init(rx_queue);
+
+  if (epfd < 0) {
+    epfd = epoll_create1(0);
+    if (epfd < 0) {
+      fprintf(stderr, "can't create epoll set: %s\n", strerror(errno));
+      return -1;
+    }
+  }
+  memset(&ev, 0, sizeof(ev));
+  /* With a receive thread, the main loop only waits for room to send */
+  ev.events = ethdev_rx_cpu < 0 ? EPOLLIN : 0;
+  ev.data.fd = nd_socket;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, nd_socket, &ev) < 0) {
+    fprintf(stderr, "can't watch socket: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (ethdev_rx_cpu >= 0) {
+    if (rx_epfd < 0) {
+      rx_epfd = epoll_create1(0);
+      if (rx_epfd < 0) {
+        fprintf(stderr, "can't create epoll set: %s\n", strerror(errno));
+        return -1;
+      }
+    }
+    ev.events = EPOLLIN;
+    if (epoll_ctl(rx_epfd, EPOLL_CTL_ADD, nd_socket, &ev) < 0) {
+      fprintf(stderr, "can't watch socket: %s\n", strerror(errno));
+      return -1;
+    }
+  }
+
+  /*
+   * The frames carry their own Ethernet header, the kernel only needs
+   * to know the outgoing device.
+   */
+  memset(&dev->tx_saddr, 0, sizeof(dev->tx_saddr));
+  dev->tx_saddr.sll_family = PF_PACKET;                 /* Raw communication */
+  dev->tx_saddr.sll_protocol = htons(ETH_P_IPV6);       /* IPv6 Protocol */
+  dev->tx_saddr.sll_ifindex = ni->ifindex;              /* Index of the network device */
+  dev->tx_saddr.sll_hatype = ARPHRD_ETHER;              /* ARP hardware identifier is ethernet */
+  dev->tx_saddr.sll_pkttype =  PACKET_OUTGOING;         /* Outgoing of any type */
+  dev->tx_saddr.sll_halen = ETH_ALEN;                   /* Address length */
+  txqueue_init(&dev->txq, ni, epfd, (struct sockaddr *) &dev->tx_saddr,
+               sizeof(dev->tx_saddr));
+  if (ethdev_rx_cpu >= 0) {
+    dev->txq.events = 0;
+  }
 
   return nd_socket;
 }
 
 /*---------------------------------------------------------------------------*/
-static int
-poll(void)
+/* The device a socket belongs to */
+static struct ethdev *
+dev_by_fd(int fd)
 {
-  fd_set rfds;
-  struct timeval tv;
-  int ret;
+  int i;
 
-  FD_ZERO(&rfds);
-  FD_SET(iface->nd_socket, &rfds);
+  for (i=0; i<UIP_DS6_LINK_NB; i++) {
+    if (devs[i].iface != NULL && devs[i].iface->nd_socket == fd) {
+      return &devs[i];
+    }
+  }
+  return NULL;
+}
 
-  /* Wait up to five milliseconds. */
-  tv.tv_sec = 0;
-  tv.tv_usec = 5000;
+/*---------------------------------------------------------------------------*/
+static int
+poll(struct epoll_event *ev, int maxevents)
+{
+  int ret;
 
-  /* Watch socket to see when it has input */
-  ret = select(iface->nd_socket+1, &rfds, NULL, NULL, &tv);
+  /* Wait up to five milliseconds for input, or for room to send */
+  ret = epoll_wait(epfd, ev, maxevents, 5);
   if (ret == -1) {
+    if (errno == EINTR) {
+      return 0;
+    }
     perror("receive packet");
     exit(errno);
   }
@@ -106,8 +299,12 @@ static uint8_t
 output(uip_lladdr_t *dst)
 {
   struct in6_addr *iaddr = &IPBUF->ip6_dst;
-  struct sockaddr_ll saddr;
-  int ret;
+  struct ethdev *dev = &devs[uip_ds6_link];
+  struct interface *iface = dev->iface;
+
+  if (iface == NULL) {
+    return 0;
+  }
 
   /*
    * If L3 dest is multicast, build L2 multicast address
@@ -130,96 +327,384 @@ output(uip_lladdr_t *dst)
   memcpy(BUF->h_source, iface->eui48, ETH_ALEN);
   BUF->h_proto = htons(ETH_P_IPV6);
 
-  uip_len += sizeof(struct ethhdr);                     /* Add Ethernet packet header */
   if (iface->verbose > 2) {
-    int i;
+    int i, len = uip_len + sizeof(struct ethhdr);     /* Add Ethernet packet header */
     char src_addrbuf[INET6_ADDRSTRLEN], dst_addrbuf[INET6_ADDRSTRLEN];
 
     inet_ntop(AF_INET6, &IPBUF->ip6_src, src_addrbuf, INET6_ADDRSTRLEN);
     inet_ntop(AF_INET6, &IPBUF->ip6_dst, dst_addrbuf, INET6_ADDRSTRLEN);
 
     fprintf(stderr, "(%s) - sending packet (len: %d) from %s to %s\n",
-        iface->name, uip_len, src_addrbuf, dst_addrbuf);
+        iface->name, len, src_addrbuf, dst_addrbuf);
     if (iface->verbose > 3) {
-      for (i=0; i<uip_len; i++) {
+      for (i=0; i<len; i++) {
         fprintf(stderr, "%02x", uip_buf[i]);
       }
       fprintf(stderr, "\n");
     }
   }
 
-  /* Prepare sockaddr_ll */
-  memset(&saddr, 0, sizeof(saddr));                     /* Clear to zero sockaddr_ll */
-  saddr.sll_family = PF_PACKET;                         /* Raw communication */
-  saddr.sll_protocol = htons(ETH_P_IPV6);               /* IPv6 Protocol */
-  saddr.sll_ifindex = iface->ifindex;                   /* Index of the network device */
-  saddr.sll_hatype = ARPHRD_ETHER;                      /* ARP hardware identifier is ethernet */
-  saddr.sll_pkttype =  PACKET_OUTGOING;                 /* Outgoing of any type */
-  saddr.sll_halen = ETH_ALEN;                           /* Address length */
-  memcpy(saddr.sll_addr, BUF->h_dest, ETH_ALEN);        /* Destination MAC address */
+  /* Queue the frame; it leaves with the rest of the burst */
+  return txqueue_put(&dev->txq);
+}
 
-  ret = sendto(iface->nd_socket, uip_buf, uip_len, 0,
-      (struct sockaddr *) &saddr, sizeof(saddr));
-  if (ret == -1) {
-    perror("send packet");
-    exit(errno);
+/*---------------------------------------------------------------------------*/
+/* Whether a received frame is for uIP, the bad ones are counted */
+static int
+accept_frame(struct interface *iface, struct mmsghdr *msg,
+             unsigned char *buf)
+{
+  struct sockaddr_ll *saddr = msg->msg_hdr.msg_name;
+  int len = msg->msg_len;
+
+  /* Anything larger than uip_buf was cut by the kernel */
+  if ((msg->msg_hdr.msg_flags & MSG_TRUNC) ||
+      (len < sizeof(struct ethhdr) + sizeof(struct ip6_hdr))) {
+    iface->rx_dropped++;
+    if (iface->verbose > 1) {
+      fprintf(stderr, "(%s) - bad frame length %d, packet dropped\n", iface->name, len);
+    }
+    return 0;
   }
-  return ret;
+
+  if (saddr->sll_ifindex != iface->ifindex) {
+    return 0;
+  }
+
+  if ((saddr->sll_pkttype != PACKET_HOST) &&
+      (saddr->sll_pkttype != PACKET_MULTICAST)) {
+    return 0;
+  }
+
+  if (iface->flags & RPLD_FLAGS) {
+    struct ip6_hdr *ip6;
+    ip6 = (struct ip6_hdr *) &buf[sizeof(struct ethhdr)];
+    if (ip6->ip6_ctlun.ip6_un1.ip6_un1_nxt != IPPROTO_ICMPV6) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*---------------------------------------------------------------------------*/
+static int
+input(struct ethdev *dev, int slot)
+{
+  struct uip_pkt *pkt = dev->rx_pkt[slot];
+
+  if (!accept_frame(dev->iface, &dev->rx_msg[slot], pkt->buf.u8)) {
+    return 0;
+  }
+
+  /* The slot's descriptor moves to the receive queue as is */
+  pkt->len = dev->rx_msg[slot].msg_len - sizeof(struct ethhdr);
+  list_add(rx_queue, pkt);
+  dev->rx_pkt[slot] = NULL;
+  return 1;
 }
 
 /*---------------------------------------------------------------------------*/
+/* Run a frame through uIP in its own buffer, no copy */
 static void
-pollhandler(void)
+deliver_frame(struct interface *iface, struct uip_pkt *pkt)
 {
-  int len;
-  struct sockaddr_ll saddr;
+  uip_pkt_enter(pkt);
 
-  unsigned char buf[iface->if_mtu];
+  if (iface->verbose > 2) {
+    int i, len = uip_len + sizeof(struct ethhdr);
+    char src_addrbuf[INET6_ADDRSTRLEN], dst_addrbuf[INET6_ADDRSTRLEN];
 
-  process_poll(&ethdev_process);
+    inet_ntop(AF_INET6, &IPBUF->ip6_src, src_addrbuf, INET6_ADDRSTRLEN);
+    inet_ntop(AF_INET6, &IPBUF->ip6_dst, dst_addrbuf, INET6_ADDRSTRLEN);
+
+    fprintf(stderr, "(%s) - received packet (len: %d) from %s to %s\n",
+        iface->name, len, src_addrbuf, dst_addrbuf);
+    if (iface->verbose > 3) {
+      for (i=0; i<len; i++) {
+        fprintf(stderr, "%02x", uip_buf[i]);
+      }
+      fprintf(stderr, "\n");
+    }
+  }
+  iface->rx_packets++;
+  /* Replies and the neighbors learned belong to the link it came from */
+  uip_ds6_set_link(iface->link);
+  tcpip_input();
+
+  uip_pkt_leave(pkt);
+}
 
-  if (poll() > 0) {
-    int saddr_len;
-    saddr_len = sizeof(struct sockaddr_ll);
-    len = recvfrom(iface->nd_socket, buf, iface->if_mtu, 0,
-        (struct sockaddr *) &saddr,  (socklen_t *) &saddr_len);
+/*---------------------------------------------------------------------------*/
+static int
+deliver(struct ethdev *dev)
+{
+  struct uip_pkt *pkt;
+  int delivered = 0;
 
-    if (saddr.sll_ifindex != iface->ifindex) {
-      return;
+  while ((pkt = list_pop(rx_queue)) != NULL) {
+    deliver_frame(dev->iface, pkt);
+    uip_pkt_free(pkt);
+    delivered++;
+  }
+  return delivered;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Read a burst from one device. Returns the number of frames delivered */
+static int
+receive(struct ethdev *dev)
+{
+  int i, n;
+
+  n = refill(dev);
+  if (n == 0) {
+    /* Out of descriptors, leave the frames in the socket for now */
+    return 0;
+  }
+  n = recvmmsg(dev->iface->nd_socket, dev->rx_msg, n, MSG_DONTWAIT, NULL);
+  if (n == -1) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      perror("receive packet");
     }
+    return 0;
+  }
+
+  for (i=0; i<n; i++) {
+    input(dev, i);
+  }
+  return deliver(dev);
+}
+
+/*---------------------------------------------------------------------------*/
+/*
+ * Read a burst from one device into the stashed slots, then free slots
+ * of the pool, from the receive thread. A filtered frame is dropped in
+ * place and its slot stashed again. When the pool is exhausted the frame
+ * is dropped here and counted, rather than left to overflow the socket
+ * buffer. Returns the number of frames queued for the main loop.
+ */
+static int
+rx_thread_receive(struct ethdev *dev)
+{
+  struct interface *iface = dev->iface;
+  struct rxframe *f;
+  int i, n, got, slot, queued = 0;
 
-    if ((saddr.sll_pkttype != PACKET_HOST) &&
-        (saddr.sll_pkttype != PACKET_MULTICAST)) {
-      return;
+  for (n=0; n<NETDRV_BATCH; n++) {
+    if (rx_nstash > 0) {
+      slot = rx_stash[--rx_nstash];
     }
+    else if ((slot = ringbuf_get(&rx_free)) < 0) {
+      break;
+    }
+    rx_slot[n] = slot;
+    rx_iov[n].iov_base = rx_frames[slot].pkt.buf.u8;
+    rx_msg[n].msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+  }
 
-    if (iface->flags & RPLD_FLAGS) {
-      struct ip6_hdr *ip6;
-      ip6 = (struct ip6_hdr *) &buf[sizeof(struct ethhdr)];
-      if (ip6->ip6_ctlun.ip6_un1.ip6_un1_nxt != IPPROTO_ICMPV6) {
-        return;
+  if (n == 0) {
+    if (recv(iface->nd_socket, NULL, 0, MSG_DONTWAIT | MSG_TRUNC) >= 0) {
+      iface->rx_overruns++;
+      if (iface->verbose > 1) {
+        fprintf(stderr, "(%s) - receive queue full, packet dropped\n", iface->name);
       }
     }
+    return 0;
+  }
 
-    memcpy(uip_buf, buf, len);
-    uip_len = len - sizeof(struct ethhdr);
-
-    if (iface->verbose > 2) {
-      int i;
-      char src_addrbuf[INET6_ADDRSTRLEN], dst_addrbuf[INET6_ADDRSTRLEN];
+  got = recvmmsg(iface->nd_socket, rx_msg, n, MSG_DONTWAIT, NULL);
+  if (got == -1) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      perror("receive packet");
+    }
+    got = 0;
+  }
 
-      inet_ntop(AF_INET6, &IPBUF->ip6_src, src_addrbuf, INET6_ADDRSTRLEN);
-      inet_ntop(AF_INET6, &IPBUF->ip6_dst, dst_addrbuf, INET6_ADDRSTRLEN);
+  for (i=0; i<n; i++) {
+    slot = rx_slot[i];
+    f = &rx_frames[slot];
+    if (i < got && accept_frame(iface, &rx_msg[i], f->pkt.buf.u8)) {
+      f->dev = dev;
+      f->pkt.len = rx_msg[i].msg_len - sizeof(struct ethhdr);
+      ringbuf_put(&rx_full, slot);
+      queued++;
+    }
+    else {
+      /* Only the main loop writes rx_free */
+      rx_stash[rx_nstash++] = slot;
+    }
+  }
+  return queued;
+}
 
-      fprintf(stderr, "(%s) - received packet (len: %d) from %s to %s\n",
-          iface->name, len, src_addrbuf, dst_addrbuf);
-      if (iface->verbose > 3) {
-        for (i=0; i<len; i++) {
-          fprintf(stderr, "%02x", buf[i]);
-        }
-        fprintf(stderr, "\n");
+/*---------------------------------------------------------------------------*/
+/* The receive thread: sleeps on the sockets, wakes the main loop up */
+static void *
+rx_thread_main(void *arg)
+{
+  struct epoll_event ev[UIP_DS6_LINK_NB];
+  struct ethdev *dev;
+  uint64_t one = 1;
+  int i, n, queued;
+
+  while (1) {
+    n = epoll_wait(rx_epfd, ev, UIP_DS6_LINK_NB, -1);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
       }
+      perror("receive thread");
+      exit(errno);
+    }
+    queued = 0;
+    for (i=0; i<n; i++) {
+      dev = dev_by_fd(ev[i].data.fd);
+      if (dev != NULL) {
+        queued += rx_thread_receive(dev);
+      }
+    }
+    if (queued && write(rx_event, &one, sizeof(one)) < 0) {
+      perror("receive thread wakeup");
+      exit(errno);
+    }
+  }
+  return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Start the receive thread, pinned to ethdev_rx_cpu */
+static void
+rx_thread_start(void)
+{
+  struct epoll_event ev;
+  cpu_set_t cpus;
+  int i, verbose = devs[0].iface != NULL ? devs[0].iface->verbose : 0;
+
+  ringbuf_init(&rx_full, rx_full_data, RX_RING_SIZE);
+  ringbuf_init(&rx_free, rx_free_data, RX_RING_SIZE);
+  for (i=0; i<ETHDEV_RX_FRAMES; i++) {
+    ringbuf_put(&rx_free, i);
+  }
+
+  memset(rx_msg, 0, sizeof(rx_msg));
+  for (i=0; i<NETDRV_BATCH; i++) {
+    rx_iov[i].iov_len = UIP_BUFSIZE;
+    rx_msg[i].msg_hdr.msg_iov = &rx_iov[i];
+    rx_msg[i].msg_hdr.msg_iovlen = 1;
+    rx_msg[i].msg_hdr.msg_name = &rx_saddr[i];
+  }
+
+  rx_event = eventfd(0, EFD_NONBLOCK);
+  if (rx_event < 0) {
+    perror("Cannot create eventfd");
+    exit(errno);
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = rx_event;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, rx_event, &ev) < 0) {
+    perror("Cannot watch eventfd");
+    exit(errno);
+  }
+
+  errno = pthread_create(&rx_thread, NULL, rx_thread_main, NULL);
+  if (errno != 0) {
+    perror("Cannot start the receive thread");
+    exit(errno);
+  }
+
+  CPU_ZERO(&cpus);
+  CPU_SET(ethdev_rx_cpu, &cpus);
+  errno = pthread_setaffinity_np(rx_thread, sizeof(cpus), &cpus);
+  if (errno != 0) {
+    fprintf(stderr, "can't pin the receive thread to CPU %d: %s\n",
+        ethdev_rx_cpu, strerror(errno));
+  }
+  else if (verbose) {
+    fprintf(stderr, "receive thread on CPU %d\n", ethdev_rx_cpu);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/*
+ * Hand uIP the frames the receive thread queued so far. Those it queues
+ * meanwhile come with its next wakeup. Returns the number delivered.
+ */
+static int
+rx_thread_deliver(void)
+{
+  struct rxframe *f;
+  uint64_t n;
+  int depth, slot, delivered = 0;
+
+  if (read(rx_event, &n, sizeof(n)) < 0 && errno != EAGAIN) {
+    perror("receive thread event");
+    exit(errno);
+  }
+
+  depth = ringbuf_elements(&rx_full);
+  if (depth > ethdev_rx_peak) {
+    ethdev_rx_peak = depth;
+  }
+  while (delivered < depth && (slot = ringbuf_get(&rx_full)) >= 0) {
+    f = &rx_frames[slot];
+    deliver_frame(f->dev->iface, &f->pkt);
+    ringbuf_put(&rx_free, slot);
+    delivered++;
+  }
+  return delivered;
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+flush(void)
+{
+  int i;
+
+  for (i=0; i<UIP_DS6_LINK_NB; i++) {
+    if (devs[i].iface != NULL) {
+      txqueue_flush(&devs[i].txq);
+    }
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+pollhandler(void)
+{
+  struct epoll_event ev[UIP_DS6_LINK_NB + 1];
+  struct ethdev *dev;
+  int i, n, delivered;
+
+  process_poll(&ethdev_process);
+
+  /* Send what timers queued since the last burst */
+  flush();
+
+  delivered = 0;
+  n = poll(ev, UIP_DS6_LINK_NB + 1);
+  for (i=0; i<n; i++) {
+    if (ev[i].data.fd == rx_event) {
+      delivered += rx_thread_deliver();
+      continue;
     }
+    dev = dev_by_fd(ev[i].data.fd);
+    if (dev == NULL) {
+      continue;
+    }
+    if (ev[i].events & EPOLLOUT) {
+      txqueue_writable(&dev->txq);
+    }
+    if (ev[i].events & EPOLLIN) {
+      delivered += receive(dev);
+    }
+  }
+
+  /* Replies may have been queued on any link */
+  if (delivered) {
+    flush();
+
+    /* One event per burst, not per frame */
     process_post(PROCESS_BROADCAST, ethnet_event, 0);
   }
 }
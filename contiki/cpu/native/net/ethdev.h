@@ -16,8 +16,17 @@
 
 #include "netdrv.h"
 
+/* Frames the receive thread can hold for the main loop, at most 127 */
+#ifdef ETHDEV_CONF_RX_FRAMES
+#define ETHDEV_RX_FRAMES         ETHDEV_CONF_RX_FRAMES
+#else
+#define ETHDEV_RX_FRAMES         127
+#endif
+
 extern struct netdrv ethdrv;
 extern process_event_t ethnet_event;
+extern int ethdev_rx_cpu;
+extern int ethdev_rx_peak;
 
 PROCESS_NAME(ethdev_process);
 
@@ -25,10 +25,57 @@
 
 #include <arpa/inet.h>
 
+#include "contiki-net.h"
 #include "netdrv.h"
 
 static struct interface nli;
 
+/* Interfaces served, indexed by uIP link */
+static struct interface *links[UIP_DS6_LINK_NB];
+static int nlinks;
+
+/*----------------------------------------------------------------------*/
+/* Give an interface the next uIP link, -1 when all are taken */
+int
+netdrv_attach(struct interface *ni)
+{
+  if (nlinks == UIP_DS6_LINK_NB) {
+    fprintf(stderr, "can't serve %s, at most %d interfaces\n",
+        ni->name, UIP_DS6_LINK_NB);
+    return -1;
+  }
+  ni->link = nlinks;
+  links[nlinks++] = ni;
+  return ni->link;
+}
+
+/*----------------------------------------------------------------------*/
+struct interface *
+netdrv_link(int link)
+{
+  if (link < 0 || link >= nlinks) {
+    return NULL;
+  }
+  return links[link];
+}
+
+/*----------------------------------------------------------------------*/
+int
+netdrv_nlinks(void)
+{
+  return nlinks;
+}
+
+/*----------------------------------------------------------------------*/
+/* uIP moved to another link, its messages now carry that link's MAC */
+void
+netdrv_link_selected(uint8_t link)
+{
+  if (link < nlinks) {
+    memcpy(&uip_lladdr.addr, links[link]->eui48, sizeof(uip_lladdr.addr));
+  }
+}
+
 /*----------------------------------------------------------------------*/
 struct interface *
 if_get_by_index(int index)
@@ -14,11 +14,19 @@
 #ifndef _NETDEV_H
 #define _NETDEV_H
 
+#include <stdint.h>
 #include <netinet/ip6.h>
 #include <linux/if.h>             /* for IFNAMSIZ */
 
 #define RPLD_FLAGS    1
 
+/* Number of frames moved per recvmmsg()/sendmmsg() call */
+#ifdef NETDRV_CONF_BATCH
+#define NETDRV_BATCH  NETDRV_CONF_BATCH
+#else
+#define NETDRV_BATCH  16
+#endif
+
 extern char  progbuf[];
 
 struct interface {
@@ -32,6 +40,8 @@ struct interface {
   struct in6_addr   *dagid;                    // Assigned DAG ID
   unsigned long      flags;                    // Interface flags
   int                metric;                   // Interface metric
+  int                non_storing;              // DODAG in non-storing mode
+  int                link;                     // uIP link, see netdrv_attach()
 
   /* Socket descriptor */
   int                nd_socket;
@@ -41,6 +51,13 @@ struct interface {
 
   int                verbose;
 
+  /* Driver statistics */
+  unsigned long      rx_packets;               // Frames handed to uIP
+  unsigned long      rx_dropped;               // Truncated or runt frames
+  unsigned long      rx_overruns;              // Frames dropped, receive queue full
+  unsigned long      tx_packets;               // Frames accepted by the kernel
+  unsigned long      tx_dropped;               // Frames dropped on transmit
+
   /* Next in the list */
   struct interface  *next;
 };
@@ -57,4 +74,13 @@ struct interface *if_get_by_name(char *);
 struct interface *if_get_active(void);
 int if_is_up(struct interface *);
 
+/*
+ * The interfaces served by the process. Each gets the next uIP link,
+ * which the drivers select on input and read back on output.
+ */
+int netdrv_attach(struct interface *);
+struct interface *netdrv_link(int link);
+int netdrv_nlinks(void);
+void netdrv_link_selected(uint8_t link);
+
 #endif /* _NETDEV_H */
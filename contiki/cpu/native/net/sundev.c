@@ -10,6 +10,8 @@
  *
  */
 
+#define _GNU_SOURCE               /* for recvmmsg() and sendmmsg() */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -21,13 +23,22 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
 
 #include <linux/if_ether.h>
 #include <arpa/inet.h>
 
 #include "contiki-net.h"
+#include "net/uip-pkt.h"
+#include "lib/list.h"
+
+#if !UIP_CONF_BUFFER_POINTER
+#error "this driver needs UIP_CONF_BUFFER_POINTER"
+#endif
 
 #include "sundev.h"
+#include "txqueue.h"
 
 #define BUF ((struct ethhdr *)&uip_buf[0])
 #define IPBUF ((struct ip6_hdr *)&uip_buf[ETH_HLEN])
@@ -42,6 +53,56 @@
 static struct interface *iface;
 static uint8_t output(uip_lladdr_t *dst);
 
+/*
+ * Receive slots, filled by one recvmmsg() per wakeup. Each slot is a
+ * packet descriptor that is queued as is and handed to uIP in place.
+ */
+static struct uip_pkt *rx_pkt[NETDRV_BATCH];
+static struct iovec rx_iov[NETDRV_BATCH];
+static struct mmsghdr rx_msg[NETDRV_BATCH];
+LIST(rx_queue);
+
+/* Transmit queue, drained at the end of each burst and on EPOLLOUT */
+static struct txqueue txq;
+static int epfd = -1;
+
+/*----------------------------------------------------------------------*/
+static void
+init_vectors(void)
+{
+  int i;
+
+  memset(rx_msg, 0, sizeof(rx_msg));
+  list_init(rx_queue);
+  for (i=0; i<NETDRV_BATCH; i++) {
+    rx_iov[i].iov_len = UIP_BUFSIZE;
+    rx_msg[i].msg_hdr.msg_iov = &rx_iov[i];
+    rx_msg[i].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+/*----------------------------------------------------------------------*/
+/*
+ * Give a descriptor to every slot that handed its own to the receive
+ * queue. Returns the number of slots, from the first, ready to receive.
+ */
+static int
+refill(void)
+{
+  int i;
+
+  for (i=0; i<NETDRV_BATCH; i++) {
+    if (rx_pkt[i] == NULL) {
+      rx_pkt[i] = uip_pkt_alloc();
+      if (rx_pkt[i] == NULL) {
+        break;
+      }
+      rx_iov[i].iov_base = rx_pkt[i]->buf.u8;
+    }
+  }
+  return i;
+}
+
 /*----------------------------------------------------------------------*/
 static void
 setoutput(void)
@@ -59,11 +120,19 @@ setup(struct interface *ni)
 {
   int nd_socket;
   int verbose = ni->verbose;
+  struct epoll_event ev;
   struct sockaddr_un sock_un;
   int len;
   char sockname[256];
   int backlog = 5;
 
+  /* The driver state is not per interface */
+  if (iface != NULL) {
+    fprintf(stderr, "%s serves a single interface, can't add %s\n",
+        sundrv.name, ni->name);
+    return -1;
+  }
+
   if (verbose) {
     fprintf(stderr, "setting up %s\n", ni->name);
   }
@@ -110,6 +179,21 @@ setup(struct interface *ni)
   }
   ni->nd_socket = nd_socket;
   iface = ni;
+  init_vectors();
+
+  epfd = epoll_create1(0);
+  if (epfd < 0) {
+    fprintf(stderr, "can't create epoll set: %s\n", strerror(errno));
+    return -1;
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = nd_socket;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, nd_socket, &ev) < 0) {
+    fprintf(stderr, "can't watch socket: %s\n", strerror(errno));
+    return -1;
+  }
+  txqueue_init(&txq, ni, epfd, NULL, 0);
 
   return nd_socket;
 }
@@ -118,24 +202,19 @@ setup(struct interface *ni)
 static int
 poll(void)
 {
-  fd_set rfds;
-  struct timeval tv;
+  struct epoll_event ev;
   int ret;
 
-  FD_ZERO(&rfds);
-  FD_SET(iface->nd_socket, &rfds);
-
-  /* Wait up to five milliseconds. */
-  tv.tv_sec = 0;
-  tv.tv_usec = 5000;
-
-  /* Watch socket to see when it has input */
-  ret = select(iface->nd_socket+1, &rfds, NULL, NULL, &tv);
+  /* Wait up to five milliseconds for input, or for room to send */
+  ret = epoll_wait(epfd, &ev, 1, 5);
   if (ret == -1) {
+    if (errno == EINTR) {
+      return 0;
+    }
     perror("receive packet");
     exit(errno);
   }
-  return ret;
+  return ret > 0 ? ev.events : 0;
 }
 
 /*----------------------------------------------------------------------*/
@@ -143,7 +222,6 @@ static uint8_t
 output(uip_lladdr_t *dst)
 {
   struct in6_addr *iaddr = &IPBUF->ip6_dst;
-  int ret;
 
   /*
    * If L3 dest is multicast, build L2 multicast address
@@ -166,60 +244,77 @@ output(uip_lladdr_t *dst)
   memcpy(BUF->h_source, iface->eui48, ETH_ALEN);
   BUF->h_proto = htons(ETH_P_IPV6);
 
-  uip_len += sizeof(struct ethhdr);                     /* Add Ethernet packet header */
   if (iface->verbose > 2) {
-    int i;
+    int i, len = uip_len + sizeof(struct ethhdr);     /* Add Ethernet packet header */
     char src_addrbuf[INET6_ADDRSTRLEN], dst_addrbuf[INET6_ADDRSTRLEN];
 
     inet_ntop(AF_INET6, &IPBUF->ip6_src, src_addrbuf, INET6_ADDRSTRLEN);
     inet_ntop(AF_INET6, &IPBUF->ip6_dst, dst_addrbuf, INET6_ADDRSTRLEN);
 
     fprintf(stderr, "(%s) - sending packet (len: %d) from %s to %s\n",
-        iface->name, uip_len, src_addrbuf, dst_addrbuf);
+        iface->name, len, src_addrbuf, dst_addrbuf);
     if (iface->verbose > 3) {
-      for (i=0; i<uip_len; i++) {
+      for (i=0; i<len; i++) {
         fprintf(stderr, "%02x", uip_buf[i]);
       }
       fprintf(stderr, "\n");
     }
   }
 
-  ret = send(iface->nd_socket, uip_buf, uip_len, 0);
-  if (ret <= 0) {
-    fprintf(stderr, "(%s) - %s\n", iface->name, strerror(errno));
-  }
-  return ret;
+  /* Queue the frame; it leaves with the rest of the burst */
+  return txqueue_put(&txq);
 }
 
 /*---------------------------------------------------------------------------*/
-static void
-pollhandler(void)
+static int
+input(int slot)
 {
-  unsigned char buf[iface->if_mtu];
-
-  process_poll(&sundev_process);
+  struct uip_pkt *pkt = rx_pkt[slot];
+  unsigned char *buf = pkt->buf.u8;
+  int len = rx_msg[slot].msg_len;
 
-  if (poll() > 0) {
-    int len;
+  if (len == 0) {
+    return 0;
+  }
 
-    len = recv(iface->nd_socket, buf, iface->if_mtu, 0);
-    if (len == 0) {
-      return;
+  /* Anything larger than uip_buf was cut by the kernel */
+  if ((rx_msg[slot].msg_hdr.msg_flags & MSG_TRUNC) ||
+      (len < sizeof(struct ethhdr) + sizeof(struct ip6_hdr))) {
+    iface->rx_dropped++;
+    if (iface->verbose > 1) {
+      fprintf(stderr, "(%s) - bad frame length %d, packet dropped\n", iface->name, len);
     }
+    return 0;
+  }
 
-    if (iface->flags & RPLD_FLAGS) {
-      struct ip6_hdr *ip6;
-      ip6 = (struct ip6_hdr *) &buf[sizeof(struct ethhdr)];
-      if (ip6->ip6_ctlun.ip6_un1.ip6_un1_nxt != IPPROTO_ICMPV6) {
-        return;
-      }
+  if (iface->flags & RPLD_FLAGS) {
+    struct ip6_hdr *ip6;
+    ip6 = (struct ip6_hdr *) &buf[sizeof(struct ethhdr)];
+    if (ip6->ip6_ctlun.ip6_un1.ip6_un1_nxt != IPPROTO_ICMPV6) {
+      return 0;
     }
+  }
 
-    memcpy(uip_buf, buf, len);
-    uip_len = len - sizeof(struct ethhdr);
+  /* The slot's descriptor moves to the receive queue as is */
+  pkt->len = len - sizeof(struct ethhdr);
+  list_add(rx_queue, pkt);
+  rx_pkt[slot] = NULL;
+  return 1;
+}
+
+/*---------------------------------------------------------------------------*/
+static int
+deliver(void)
+{
+  struct uip_pkt *pkt;
+  int delivered = 0;
+
+  /* Each frame goes through uIP in its own buffer, no copy */
+  while ((pkt = list_pop(rx_queue)) != NULL) {
+    uip_pkt_enter(pkt);
 
     if (iface->verbose > 2) {
-      int i;
+      int i, len = uip_len + sizeof(struct ethhdr);
       char src_addrbuf[INET6_ADDRSTRLEN], dst_addrbuf[INET6_ADDRSTRLEN];
 
       inet_ntop(AF_INET6, &IPBUF->ip6_src, src_addrbuf, INET6_ADDRSTRLEN);
@@ -229,12 +324,60 @@ pollhandler(void)
           iface->name, len, src_addrbuf, dst_addrbuf);
       if (iface->verbose > 3) {
         for (i=0; i<len; i++) {
-          fprintf(stderr, "%02x", buf[i]);
+          fprintf(stderr, "%02x", uip_buf[i]);
         }
         fprintf(stderr, "\n");
       }
     }
-    process_post(PROCESS_BROADCAST, ethnet_event, 0);
+    iface->rx_packets++;
+    tcpip_input();
+
+    uip_pkt_leave(pkt);
+    uip_pkt_free(pkt);
+    delivered++;
+  }
+  return delivered;
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+pollhandler(void)
+{
+  int i, n, delivered, events;
+
+  process_poll(&sundev_process);
+
+  /* Send what timers queued since the last burst */
+  txqueue_flush(&txq);
+
+  events = poll();
+  if (events & EPOLLOUT) {
+    txqueue_writable(&txq);
+  }
+  if (events & EPOLLIN) {
+    n = refill();
+    if (n == 0) {
+      /* Out of descriptors, leave the frames in the socket for now */
+      return;
+    }
+    n = recvmmsg(iface->nd_socket, rx_msg, n, MSG_DONTWAIT, NULL);
+    if (n == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        fprintf(stderr, "(%s) - %s\n", iface->name, strerror(errno));
+      }
+      return;
+    }
+
+    for (i=0; i<n; i++) {
+      input(i);
+    }
+    delivered = deliver();
+    txqueue_flush(&txq);
+
+    /* One event per burst, not per frame */
+    if (delivered) {
+      process_post(PROCESS_BROADCAST, ethnet_event, 0);
+    }
   }
 }
 
@@ -0,0 +1,238 @@
+/*
+ * txqueue.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version
+ * 2 of the Licence, or (at your option) any later version.
+ *
+ * Authors: Zafi Ramarosandratana (Rosand Technologies)
+ *
+ */
+
+#define _GNU_SOURCE               /* for sendmmsg() */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+#include <linux/if_ether.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+
+#include "txqueue.h"
+
+#define ICMP6_RPL        155
+
+/*----------------------------------------------------------------------*/
+static int
+classify(const uint8_t *frame, int len)
+{
+  const struct ip6_hdr *ip6 = (const struct ip6_hdr *) &frame[ETH_HLEN];
+  uint8_t type;
+
+  if (len < ETH_HLEN + sizeof(struct ip6_hdr) + 1 ||
+      ip6->ip6_ctlun.ip6_un1.ip6_un1_nxt != IPPROTO_ICMPV6) {
+    return TXQUEUE_BULK;
+  }
+  type = frame[ETH_HLEN + sizeof(struct ip6_hdr)];
+  if (type == ICMP6_RPL ||
+      (type >= ND_ROUTER_SOLICIT && type <= ND_REDIRECT)) {
+    return TXQUEUE_CONTROL;
+  }
+  return TXQUEUE_BULK;
+}
+
+/*----------------------------------------------------------------------*/
+static void
+fifo_add(struct txqueue *q, int class, struct uip_pkt *pkt)
+{
+  list_add(q->fifo[class], pkt);
+  q->count[class]++;
+}
+
+/*----------------------------------------------------------------------*/
+static void
+fifo_free_head(struct txqueue *q, int class)
+{
+  uip_pkt_free(list_pop(q->fifo[class]));
+  q->count[class]--;
+}
+
+/*----------------------------------------------------------------------*/
+static void
+fifo_free_tail(struct txqueue *q, int class)
+{
+  uip_pkt_free(list_chop(q->fifo[class]));
+  q->count[class]--;
+}
+
+/*----------------------------------------------------------------------*/
+static void
+set_backlog(struct txqueue *q, int backlog)
+{
+  struct epoll_event ev;
+
+  if (q->backlog == backlog) {
+    return;
+  }
+  q->backlog = backlog;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = q->events | (backlog ? EPOLLOUT : 0);
+  ev.data.fd = q->fd;
+  if (epoll_ctl(q->epfd, EPOLL_CTL_MOD, q->fd, &ev) < 0) {
+    fprintf(stderr, "(%s) - epoll_ctl: %s\n", q->iface->name, strerror(errno));
+  }
+}
+
+/*----------------------------------------------------------------------*/
+void
+txqueue_init(struct txqueue *q, struct interface *iface, int epfd,
+             struct sockaddr *name, socklen_t namelen)
+{
+  int c;
+
+  memset(q, 0, sizeof(*q));
+  q->iface = iface;
+  q->fd = iface->nd_socket;
+  q->epfd = epfd;
+  q->events = EPOLLIN;
+  q->name = name;
+  q->namelen = namelen;
+  for (c=0; c<TXQUEUE_CLASSES; c++) {
+    q->fifo[c] = (list_t) &q->fifo_list[c];
+    list_init(q->fifo[c]);
+  }
+}
+
+/*----------------------------------------------------------------------*/
+int
+txqueue_pending(struct txqueue *q)
+{
+  return q->count[TXQUEUE_CONTROL] + q->count[TXQUEUE_BULK];
+}
+
+/*----------------------------------------------------------------------*/
+/*
+ * Queue the packet in uip_buf, link layer header included. Returns 0
+ * when it had to be dropped.
+ */
+int
+txqueue_put(struct txqueue *q)
+{
+  struct uip_pkt *pkt;
+  int class, full;
+
+  class = classify(uip_buf, UIP_LLH_LEN + uip_len);
+
+  full = txqueue_pending(q) >= TXQUEUE_SIZE || uip_pkt_available() == 0;
+  if (full && !q->backlog) {
+    txqueue_flush(q);
+    full = txqueue_pending(q) >= TXQUEUE_SIZE || uip_pkt_available() == 0;
+  }
+  if (full) {
+    /* Control traffic may take the place of the newest bulk frame */
+    if (class == TXQUEUE_CONTROL && q->count[TXQUEUE_BULK] > 0) {
+      fifo_free_tail(q, TXQUEUE_BULK);
+      q->evicted++;
+      q->dropped[TXQUEUE_BULK]++;
+      q->iface->tx_dropped++;
+    } else {
+      q->dropped[class]++;
+      q->iface->tx_dropped++;
+      if (q->iface->verbose > 1) {
+        fprintf(stderr, "(%s) - transmit queue full, %s packet dropped\n",
+            q->iface->name, class == TXQUEUE_CONTROL ? "control" : "bulk");
+      }
+      return 0;
+    }
+  }
+
+  pkt = uip_pkt_save();
+  if (pkt == NULL) {
+    q->dropped[class]++;
+    q->iface->tx_dropped++;
+    return 0;
+  }
+  fifo_add(q, class, pkt);
+  q->queued[class]++;
+  return 1;
+}
+
+/*----------------------------------------------------------------------*/
+/*
+ * Send as many frames as the socket takes, control class first. Frames
+ * left over when the socket is full wait for EPOLLOUT.
+ */
+static void
+drain(struct txqueue *q)
+{
+  struct mmsghdr msg[NETDRV_BATCH];
+  struct iovec iov[NETDRV_BATCH];
+  int class[NETDRV_BATCH];
+  int n, i, c, ret;
+
+  while (txqueue_pending(q) > 0) {
+    /* Gather the heads of the fifos, control then bulk */
+    n = 0;
+    for (c=0; c<TXQUEUE_CLASSES && n<NETDRV_BATCH; c++) {
+      struct uip_pkt *pkt;
+
+      for (pkt = list_head(q->fifo[c]); pkt != NULL && n < NETDRV_BATCH;
+          pkt = list_item_next(pkt), n++) {
+        iov[n].iov_base = pkt->buf.u8;
+        iov[n].iov_len = UIP_LLH_LEN + pkt->len;
+        memset(&msg[n], 0, sizeof(msg[n]));
+        msg[n].msg_hdr.msg_iov = &iov[n];
+        msg[n].msg_hdr.msg_iovlen = 1;
+        msg[n].msg_hdr.msg_name = q->name;
+        msg[n].msg_hdr.msg_namelen = q->namelen;
+        class[n] = c;
+      }
+    }
+
+    ret = sendmmsg(q->fd, msg, n, MSG_DONTWAIT);
+    if (ret > 0) {
+      for (i=0; i<ret; i++) {
+        fifo_free_head(q, class[i]);
+      }
+      q->iface->tx_packets += ret;
+      continue;
+    }
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    }
+    if (ret == 0 || errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+      set_backlog(q, 1);
+      return;
+    }
+    /* The head frame was rejected: drop it and go on with the others */
+    fprintf(stderr, "(%s) - send packet: %s\n", q->iface->name, strerror(errno));
+    fifo_free_head(q, class[0]);
+    q->dropped[class[0]]++;
+    q->iface->tx_dropped++;
+  }
+  set_backlog(q, 0);
+}
+
+/*----------------------------------------------------------------------*/
+void
+txqueue_flush(struct txqueue *q)
+{
+  /* Once backlogged, only EPOLLOUT resumes the transmission */
+  if (!q->backlog) {
+    drain(q);
+  }
+}
+
+/*----------------------------------------------------------------------*/
+void
+txqueue_writable(struct txqueue *q)
+{
+  drain(q);
+}
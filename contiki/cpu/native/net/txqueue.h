@@ -0,0 +1,64 @@
+/*
+ * txqueue.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version
+ * 2 of the Licence, or (at your option) any later version.
+ *
+ * Authors: Zafi Ramarosandratana (Rosand Technologies)
+ *
+ */
+
+
+#ifndef _TXQUEUE_H
+#define _TXQUEUE_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "contiki-net.h"
+#include "net/uip-pkt.h"
+#include "lib/list.h"
+#include "netdrv.h"
+
+/* Frames held per interface while the socket is not writable */
+#ifdef TXQUEUE_CONF_SIZE
+#define TXQUEUE_SIZE     TXQUEUE_CONF_SIZE
+#else
+#define TXQUEUE_SIZE     64
+#endif
+
+/* Traffic classes, in the order they are drained */
+#define TXQUEUE_CONTROL  0        /* RPL and neighbor discovery messages */
+#define TXQUEUE_BULK     1        /* Everything else */
+#define TXQUEUE_CLASSES  2
+
+struct txqueue {
+  struct interface  *iface;
+  int                fd;                       // Socket the frames leave on
+  int                epfd;                     // epoll set watching fd
+  int                backlog;                  // Waiting for EPOLLOUT
+  uint32_t           events;                   // Watched on fd besides EPOLLOUT
+  struct sockaddr   *name;                     // Destination for every frame, or NULL
+  socklen_t          namelen;
+
+  /* Packet descriptors waiting to be sent, per class */
+  void              *fifo_list[TXQUEUE_CLASSES];
+  list_t             fifo[TXQUEUE_CLASSES];
+  int                count[TXQUEUE_CLASSES];
+
+  /* Statistics */
+  unsigned long      queued[TXQUEUE_CLASSES];  // Frames accepted per class
+  unsigned long      dropped[TXQUEUE_CLASSES]; // Frames refused or lost per class
+  unsigned long      evicted;                  // Bulk frames pushed out by control
+};
+
+void txqueue_init(struct txqueue *q, struct interface *iface, int epfd,
+                  struct sockaddr *name, socklen_t namelen);
+int txqueue_put(struct txqueue *q);
+void txqueue_flush(struct txqueue *q);
+void txqueue_writable(struct txqueue *q);
+int txqueue_pending(struct txqueue *q);
+
+#endif /* _TXQUEUE_H */
@@ -0,0 +1,663 @@
+/*
+ * uringdev.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version
+ * 2 of the Licence, or (at your option) any later version.
+ *
+ * Authors: Zafi Ramarosandratana (Rosand Technologies)
+ *
+ */
+
+/*
+ * Ethernet driver on top of io_uring. One multishot RECVMSG stays
+ * posted on the packet socket and lands frames in buffers provided to
+ * the kernel through a buffer ring; uIP processes them in place. Sends
+ * are queued as SENDMSG requests. Submitting and reaping both happen
+ * in a single io_uring_enter() per loop, which sleeps until a
+ * completion arrives or the next Contiki timer is due.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include <linux/io_uring.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <net/if_arp.h>
+#include <netinet/ip6.h>
+#include <arpa/inet.h>
+
+#include "contiki-net.h"
+#include "net/uip-pkt.h"
+
+#if !UIP_CONF_BUFFER_POINTER
+#error "this driver needs UIP_CONF_BUFFER_POINTER"
+#endif
+
+#include "ethdev.h"
+#include "uringdev.h"
+
+#define BUF ((struct ethhdr *)&uip_buf[0])
+#define IPBUF ((struct ip6_hdr *)&uip_buf[ETH_HLEN])
+
+/* user_data of the receive request, sends carry their slot number */
+#define URING_RX                 0xffffffffffffffffULL
+
+/* Buffer group of the receive buffers */
+#define URING_RX_BGID            0
+
+/* A receive buffer: recvmsg header, source address, then the frame */
+#define URING_RX_HDRLEN          (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_ll))
+#define URING_RX_BUFLEN          ((URING_RX_HDRLEN + UIP_BUFSIZE + 63) & ~63)
+
+/***********************************************************************************
+ * LOCAL DATA
+ */
+static struct interface *iface;
+static uint8_t output(uip_lladdr_t *dst);
+
+/* Rings shared with the kernel */
+static struct {
+  int fd;
+  unsigned entries;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned sq_local;                           // Tail including unsubmitted entries
+  unsigned to_submit;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+} ring;
+
+/* Receive side */
+static struct io_uring_buf_ring *rx_ring;
+static unsigned char *rx_area;
+static unsigned short rx_ring_tail;
+static struct msghdr rx_msghdr;
+static int rx_armed;
+
+/* Send side */
+struct uring_tx {
+  struct uip_pkt *pkt;
+  struct msghdr msg;
+  struct iovec iov;
+};
+static struct uring_tx tx_slot[URINGDEV_TX_SLOTS];
+static int tx_free[URINGDEV_TX_SLOTS];
+static int tx_nfree;
+static struct sockaddr_ll tx_saddr;
+
+/*----------------------------------------------------------------------*/
+static int
+sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                   unsigned flags, void *arg, size_t argsz)
+{
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int
+sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*----------------------------------------------------------------------*/
+static int
+ring_init(void)
+{
+  struct io_uring_params p;
+  size_t sq_len, cq_len;
+  unsigned char *sq_ptr, *cq_ptr;
+
+  memset(&p, 0, sizeof(p));
+  ring.fd = sys_io_uring_setup(URINGDEV_ENTRIES, &p);
+  if (ring.fd < 0) {
+    fprintf(stderr, "can't set up io_uring: %s\n", strerror(errno));
+    return -1;
+  }
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+    fprintf(stderr, "io_uring: kernel too old\n");
+    close(ring.fd);
+    return -1;
+  }
+
+  sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (cq_len > sq_len) {
+    sq_len = cq_len;
+  }
+  sq_ptr = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      ring.fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED) {
+    fprintf(stderr, "io_uring: can't map rings: %s\n", strerror(errno));
+    close(ring.fd);
+    return -1;
+  }
+  cq_ptr = sq_ptr;
+
+  ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+  if (ring.sqes == MAP_FAILED) {
+    fprintf(stderr, "io_uring: can't map entries: %s\n", strerror(errno));
+    close(ring.fd);
+    return -1;
+  }
+
+  ring.entries = p.sq_entries;
+  ring.sq_head = (unsigned *) (sq_ptr + p.sq_off.head);
+  ring.sq_tail = (unsigned *) (sq_ptr + p.sq_off.tail);
+  ring.sq_mask = (unsigned *) (sq_ptr + p.sq_off.ring_mask);
+  ring.sq_array = (unsigned *) (sq_ptr + p.sq_off.array);
+  ring.sq_local = *ring.sq_tail;
+  ring.to_submit = 0;
+  ring.cq_head = (unsigned *) (cq_ptr + p.cq_off.head);
+  ring.cq_tail = (unsigned *) (cq_ptr + p.cq_off.tail);
+  ring.cq_mask = (unsigned *) (cq_ptr + p.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe *) (cq_ptr + p.cq_off.cqes);
+  return 0;
+}
+
+/*----------------------------------------------------------------------*/
+/*
+ * Submit what is queued and wait for at least min_complete completions,
+ * no longer than the given number of milliseconds.
+ */
+static int
+ring_enter(unsigned min_complete, long msec)
+{
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  int ret;
+
+  memset(&arg, 0, sizeof(arg));
+  ts.tv_sec = msec / 1000;
+  ts.tv_nsec = (msec % 1000) * 1000000;
+  arg.ts = (unsigned long) &ts;
+
+  ret = sys_io_uring_enter(ring.fd, ring.to_submit, min_complete,
+      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+  if (ret >= 0) {
+    ring.to_submit -= ret;
+  } else if (errno != ETIME && errno != EINTR && errno != EBUSY) {
+    fprintf(stderr, "(%s) - io_uring_enter: %s\n", iface->name, strerror(errno));
+  }
+  return ret;
+}
+
+/*----------------------------------------------------------------------*/
+static struct io_uring_sqe *
+get_sqe(void)
+{
+  struct io_uring_sqe *sqe;
+  unsigned index;
+
+  if (ring.sq_local - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >= ring.entries) {
+    /* Submission queue full, hand it over without waiting */
+    ring_enter(0, 0);
+    if (ring.sq_local - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >= ring.entries) {
+      return NULL;
+    }
+  }
+  index = ring.sq_local & *ring.sq_mask;
+  sqe = &ring.sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  ring.sq_array[index] = index;
+  return sqe;
+}
+
+static void
+commit_sqe(void)
+{
+  ring.sq_local++;
+  ring.to_submit++;
+  __atomic_store_n(ring.sq_tail, ring.sq_local, __ATOMIC_RELEASE);
+}
+
+/*----------------------------------------------------------------------*/
+static void
+rx_recycle(unsigned short bid)
+{
+  struct io_uring_buf *buf;
+
+  buf = &rx_ring->bufs[rx_ring_tail & (URINGDEV_RX_BUFFERS - 1)];
+  buf->addr = (unsigned long) (rx_area + bid * URING_RX_BUFLEN);
+  buf->len = URING_RX_BUFLEN;
+  buf->bid = bid;
+  rx_ring_tail++;
+}
+
+static void
+rx_publish(void)
+{
+  __atomic_store_n(&rx_ring->tail, rx_ring_tail, __ATOMIC_RELEASE);
+}
+
+/*----------------------------------------------------------------------*/
+static int
+rx_init(void)
+{
+  struct io_uring_buf_reg reg;
+  int i;
+
+  if (posix_memalign((void **) &rx_ring, getpagesize(),
+      URINGDEV_RX_BUFFERS * sizeof(struct io_uring_buf)) != 0 ||
+      posix_memalign((void **) &rx_area, 64, URINGDEV_RX_BUFFERS * URING_RX_BUFLEN) != 0) {
+    fprintf(stderr, "io_uring: can't allocate receive buffers\n");
+    return -1;
+  }
+  memset(rx_ring, 0, URINGDEV_RX_BUFFERS * sizeof(struct io_uring_buf));
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (unsigned long) rx_ring;
+  reg.ring_entries = URINGDEV_RX_BUFFERS;
+  reg.bgid = URING_RX_BGID;
+  if (sys_io_uring_register(ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    fprintf(stderr, "io_uring: can't register receive buffers: %s\n", strerror(errno));
+    return -1;
+  }
+
+  rx_ring_tail = 0;
+  for (i=0; i<URINGDEV_RX_BUFFERS; i++) {
+    rx_recycle(i);
+  }
+  rx_publish();
+
+  /* The kernel only looks at the sizes: source address, no control data */
+  memset(&rx_msghdr, 0, sizeof(rx_msghdr));
+  rx_msghdr.msg_namelen = sizeof(struct sockaddr_ll);
+  return 0;
+}
+
+/*----------------------------------------------------------------------*/
+static void
+rx_arm(void)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe = get_sqe();
+  if (sqe == NULL) {
+    return;
+  }
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = iface->nd_socket;
+  sqe->addr = (unsigned long) &rx_msghdr;
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_RX_BGID;
+  sqe->user_data = URING_RX;
+  commit_sqe();
+  rx_armed = 1;
+}
+
+/*----------------------------------------------------------------------*/
+static void
+setoutput(void)
+{
+  process_start(&uringdev_process, NULL);
+
+  tcpip_set_outputfunc(output);
+}
+
+/*----------------------------------------------------------------------*/
+static int
+setup(struct interface *ni)
+{
+  int nd_socket;
+  int verbose = ni->verbose;
+  int i;
+
+  /* The driver state is not per interface */
+  if (iface != NULL) {
+    fprintf(stderr, "%s serves a single interface, can't add %s\n",
+        uringdrv.name, ni->name);
+    return -1;
+  }
+
+  if (verbose) {
+    fprintf(stderr, "setting up %s (io_uring)\n", ni->name);
+  }
+
+  nd_socket = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+
+  if (nd_socket < 0) {
+    fprintf(stderr, "can't create socket(AF_PACKET): %s\n", strerror(errno));
+    return -1;
+  }
+
+  ni->nd_socket = nd_socket;
+  iface = ni;
+
+  if (ring_init() < 0) {
+    close(nd_socket);
+    return -1;
+  }
+  if (rx_init() < 0) {
+    close(ring.fd);
+    close(nd_socket);
+    return -1;
+  }
+
+  /*
+   * The frames carry their own Ethernet header, the kernel only needs
+   * to know the outgoing device.
+   */
+  memset(&tx_saddr, 0, sizeof(tx_saddr));
+  tx_saddr.sll_family = PF_PACKET;                      /* Raw communication */
+  tx_saddr.sll_protocol = htons(ETH_P_IPV6);            /* IPv6 Protocol */
+  tx_saddr.sll_ifindex = ni->ifindex;                   /* Index of the network device */
+  tx_saddr.sll_hatype = ARPHRD_ETHER;                   /* ARP hardware identifier is ethernet */
+  tx_saddr.sll_pkttype =  PACKET_OUTGOING;              /* Outgoing of any type */
+  tx_saddr.sll_halen = ETH_ALEN;                        /* Address length */
+
+  for (i=0; i<URINGDEV_TX_SLOTS; i++) {
+    tx_slot[i].msg.msg_name = &tx_saddr;
+    tx_slot[i].msg.msg_namelen = sizeof(tx_saddr);
+    tx_slot[i].msg.msg_iov = &tx_slot[i].iov;
+    tx_slot[i].msg.msg_iovlen = 1;
+    tx_free[i] = i;
+  }
+  tx_nfree = URINGDEV_TX_SLOTS;
+
+  rx_arm();
+
+  return nd_socket;
+}
+
+/*----------------------------------------------------------------------*/
+static uint8_t
+output(uip_lladdr_t *dst)
+{
+  struct in6_addr *iaddr = &IPBUF->ip6_dst;
+  struct io_uring_sqe *sqe;
+  struct uring_tx *tx;
+
+  /*
+   * If L3 dest is multicast, build L2 multicast address
+   * as per RFC 2464 section 7
+   * else fill with the address in argument
+   */
+  if (dst == NULL) {
+    if (iface->verbose > 3) {
+      fprintf(stderr, "(%s) - build L2 dest multicast address\n", iface->name);
+    }
+    BUF->h_dest[0] = 0x33;
+    BUF->h_dest[1] = 0x33;
+    BUF->h_dest[2] = iaddr->s6_addr[12];
+    BUF->h_dest[3] = iaddr->s6_addr[13];
+    BUF->h_dest[4] = iaddr->s6_addr[14];
+    BUF->h_dest[5] = iaddr->s6_addr[15];
+  } else {
+    memcpy(BUF->h_dest, dst, ETH_ALEN);
+  }
+  memcpy(BUF->h_source, iface->eui48, ETH_ALEN);
+  BUF->h_proto = htons(ETH_P_IPV6);
+
+  if (iface->verbose > 2) {
+    int i, len = uip_len + sizeof(struct ethhdr);     /* Add Ethernet packet header */
+    char src_addrbuf[INET6_ADDRSTRLEN], dst_addrbuf[INET6_ADDRSTRLEN];
+
+    inet_ntop(AF_INET6, &IPBUF->ip6_src, src_addrbuf, INET6_ADDRSTRLEN);
+    inet_ntop(AF_INET6, &IPBUF->ip6_dst, dst_addrbuf, INET6_ADDRSTRLEN);
+
+    fprintf(stderr, "(%s) - sending packet (len: %d) from %s to %s\n",
+        iface->name, len, src_addrbuf, dst_addrbuf);
+    if (iface->verbose > 3) {
+      for (i=0; i<len; i++) {
+        fprintf(stderr, "%02x", uip_buf[i]);
+      }
+      fprintf(stderr, "\n");
+    }
+  }
+
+  /* The frame must outlive uip_buf until the send completes */
+  if (tx_nfree == 0 || (sqe = get_sqe()) == NULL) {
+    iface->tx_dropped++;
+    if (iface->verbose > 1) {
+      fprintf(stderr, "(%s) - too many sends in flight, packet dropped\n", iface->name);
+    }
+    return 0;
+  }
+  tx = &tx_slot[tx_free[tx_nfree - 1]];
+  tx->pkt = uip_pkt_save();
+  if (tx->pkt == NULL) {
+    iface->tx_dropped++;
+    return 0;
+  }
+  tx_nfree--;
+  tx->iov.iov_base = tx->pkt->buf.u8;
+  tx->iov.iov_len = UIP_LLH_LEN + tx->pkt->len;
+
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = iface->nd_socket;
+  sqe->addr = (unsigned long) &tx->msg;
+  sqe->len = 1;
+  sqe->user_data = tx - tx_slot;
+  commit_sqe();
+  return 1;
+}
+
+/*---------------------------------------------------------------------------*/
+static int
+input(struct io_uring_cqe *cqe)
+{
+  unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+  unsigned char *buf = rx_area + bid * URING_RX_BUFLEN;
+  struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *) buf;
+  struct sockaddr_ll *saddr = (struct sockaddr_ll *) (out + 1);
+  unsigned char *frame = buf + URING_RX_HDRLEN;
+  int len = out->payloadlen;
+  int ret = 0;
+
+  /*
+   * The buffers are rounded up and leave room for frames larger than
+   * uip_buf, which uIP and uip_pkt_save() could not hold.
+   */
+  if ((out->flags & MSG_TRUNC) || (len > UIP_BUFSIZE) ||
+      (len < sizeof(struct ethhdr) + sizeof(struct ip6_hdr))) {
+    iface->rx_dropped++;
+    if (iface->verbose > 1) {
+      fprintf(stderr, "(%s) - bad frame length %d, packet dropped\n", iface->name, len);
+    }
+    goto recycle;
+  }
+
+  if (saddr->sll_ifindex != iface->ifindex) {
+    goto recycle;
+  }
+
+  if ((saddr->sll_pkttype != PACKET_HOST) &&
+      (saddr->sll_pkttype != PACKET_MULTICAST)) {
+    goto recycle;
+  }
+
+  if (iface->flags & RPLD_FLAGS) {
+    struct ip6_hdr *ip6;
+    ip6 = (struct ip6_hdr *) &frame[sizeof(struct ethhdr)];
+    if (ip6->ip6_ctlun.ip6_un1.ip6_un1_nxt != IPPROTO_ICMPV6) {
+      goto recycle;
+    }
+  }
+
+  /* uIP works on the kernel's buffer, no copy */
+  uip_bufptr = (uip_buf_t *) frame;
+  uip_len = len - sizeof(struct ethhdr);
+
+  if (iface->verbose > 2) {
+    int i;
+    char src_addrbuf[INET6_ADDRSTRLEN], dst_addrbuf[INET6_ADDRSTRLEN];
+
+    inet_ntop(AF_INET6, &IPBUF->ip6_src, src_addrbuf, INET6_ADDRSTRLEN);
+    inet_ntop(AF_INET6, &IPBUF->ip6_dst, dst_addrbuf, INET6_ADDRSTRLEN);
+
+    fprintf(stderr, "(%s) - received packet (len: %d) from %s to %s\n",
+        iface->name, len, src_addrbuf, dst_addrbuf);
+    if (iface->verbose > 3) {
+      for (i=0; i<len; i++) {
+        fprintf(stderr, "%02x", frame[i]);
+      }
+      fprintf(stderr, "\n");
+    }
+  }
+  iface->rx_packets++;
+  tcpip_input();
+  uip_bufptr = &uip_aligned_buf;
+  ret = 1;
+
+recycle:
+  rx_recycle(bid);
+  return ret;
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+tx_complete(struct io_uring_cqe *cqe)
+{
+  struct uring_tx *tx = &tx_slot[cqe->user_data];
+
+  if (cqe->res < 0) {
+    iface->tx_dropped++;
+    if (iface->verbose > 1) {
+      fprintf(stderr, "(%s) - send packet: %s\n", iface->name, strerror(-cqe->res));
+    }
+  } else {
+    iface->tx_packets++;
+  }
+  uip_pkt_free(tx->pkt);
+  tx->pkt = NULL;
+  tx_free[tx_nfree++] = tx - tx_slot;
+}
+
+/*---------------------------------------------------------------------------*/
+/*
+ * Sleep until the next Contiki timer is due, unless some process has
+ * work queued already.
+ */
+static long
+wait_time(void)
+{
+  clock_time_t now, next;
+
+  if (process_nevents() > 0) {
+    return 0;
+  }
+  if (!etimer_pending()) {
+    return 1000;
+  }
+  now = clock_time();
+  next = etimer_next_expiration_time();
+  if (next <= now) {
+    return 0;
+  }
+  return (long) ((next - now) * 1000 / CLOCK_SECOND);
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+pollhandler(void)
+{
+  struct io_uring_cqe *cqe;
+  unsigned head, tail;
+  long msec;
+  int delivered;
+
+  if (!rx_armed) {
+    rx_arm();
+  }
+
+  /*
+   * Submit the queued sends and wait for completions in one system
+   * call. The wait is computed before polling ourselves again, our own
+   * request would otherwise always count as pending work.
+   */
+  msec = wait_time();
+  if (ring.to_submit > 0 || msec > 0) {
+    ring_enter(msec > 0 ? 1 : 0, msec);
+  }
+
+  process_poll(&uringdev_process);
+
+  delivered = 0;
+  head = *ring.cq_head;
+  tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    cqe = &ring.cqes[head & *ring.cq_mask];
+
+    if (cqe->user_data != URING_RX) {
+      tx_complete(cqe);
+      continue;
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      /* The multishot request ended, post it again below */
+      rx_armed = 0;
+    }
+    if (cqe->res < 0) {
+      if (cqe->res != -ENOBUFS && iface->verbose) {
+        fprintf(stderr, "(%s) - receive packet: %s\n", iface->name, strerror(-cqe->res));
+      }
+      continue;
+    }
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+      delivered += input(cqe);
+    }
+  }
+  __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+  rx_publish();
+
+  if (!rx_armed) {
+    rx_arm();
+  }
+
+  /* One event per burst, not per frame */
+  if (delivered) {
+    process_post(PROCESS_BROADCAST, ethnet_event, 0);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+uringnet_exit(char *st)
+{
+  fprintf(stderr, "%s process exited\n", st);
+}
+
+/*---------------------------------------------------------------------------*/
+PROCESS(uringdev_process, "io_uring device process");
+
+PROCESS_THREAD(uringdev_process, ev, data)
+{
+  PROCESS_POLLHANDLER(pollhandler());
+  PROCESS_EXITHANDLER(uringnet_exit("URINGDEV"))
+
+  PROCESS_BEGIN();
+  process_poll(&uringdev_process);
+
+  PROCESS_WAIT_UNTIL(ev == PROCESS_EVENT_EXIT);
+
+  PROCESS_END();
+}
+
+struct netdrv uringdrv = {
+    "io_uring",
+    setup,
+    setoutput
+};
@@ -0,0 +1,45 @@
+/*
+ * uringdev.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, either version
+ * 2 of the Licence, or (at your option) any later version.
+ *
+ * Authors: Zafi Ramarosandratana (Rosand Technologies)
+ *
+ */
+
+
+#ifndef _URINGDEV_H
+#define _URINGDEV_H
+
+#include "netdrv.h"
+
+/* Submission queue depth */
+#ifdef URINGDEV_CONF_ENTRIES
+#define URINGDEV_ENTRIES         URINGDEV_CONF_ENTRIES
+#else
+#define URINGDEV_ENTRIES         64
+#endif
+
+/* Receive buffers provided to the kernel, a power of two */
+#ifdef URINGDEV_CONF_RX_BUFFERS
+#define URINGDEV_RX_BUFFERS      URINGDEV_CONF_RX_BUFFERS
+#else
+#define URINGDEV_RX_BUFFERS      64
+#endif
+
+/* Sends in flight at once */
+#ifdef URINGDEV_CONF_TX_SLOTS
+#define URINGDEV_TX_SLOTS        URINGDEV_CONF_TX_SLOTS
+#else
+#define URINGDEV_TX_SLOTS        32
+#endif
+
+extern struct netdrv uringdrv;
+extern process_event_t ethnet_event;
+
+PROCESS_NAME(uringdev_process);
+
+#endif /* _URINGDEV_H */
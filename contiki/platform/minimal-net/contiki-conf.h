@@ -144,6 +144,15 @@ typedef unsigned short uip_stats_t;
 #define UIP_CONF_IP_FORWARD           0
 #define UIP_CONF_LOGGING              0
 #define UIP_CONF_UDP_CHECKSUMS        1
+/* The native drivers let uIP work on their receive slots directly */
+#define UIP_CONF_BUFFER_POINTER       1
+/*
+ * Receive slots and transmit queues of the native drivers. Each link
+ * keeps a batch of receive slots filled while idle; the rest is left
+ * for the replies and the frames waiting to be sent.
+ */
+#define NETDRV_CONF_BATCH             16
+#define UIP_CONF_PKT_NUM              (UIP_CONF_DS6_LINK_NB * NETDRV_CONF_BATCH + 96)
 
 /* Not used but avoids compile errors while sicslowpan.c is being developed */
 #define SICSLOWPAN_CONF_COMPRESSION       SICSLOWPAN_COMPRESSION_HC06
@@ -163,6 +172,17 @@ typedef unsigned short uip_stats_t;
 #define UIP_CONF_DS6_DEFRT_NBU   2
 #define UIP_CONF_DS6_PREFIX_NBU  5
 #define UIP_CONF_DS6_ROUTE_NBU   1000
+#define UIP_CONF_DS6_ROUTE_HASH  1024
+#define UIP_CONF_DS6_ROUTE_LOG_NB 1024
+#define RPL_CONF_NS_LINK_NUM     1000
+#define RPL_CONF_NS_HASH_SIZE    1024
+/* rpld hands route messages to its netlink thread through ring buffers */
+#define RINGBUF_CONF_BARRIER()   __sync_synchronize()
+
+/* Interfaces rpld serves at once, one RPL instance each */
+#define UIP_CONF_DS6_LINK_NB     8
+#define UIP_CONF_DS6_LINK_SELECTED netdrv_link_selected
+#define RPL_CONF_MAX_INSTANCES   UIP_CONF_DS6_LINK_NB
 #define UIP_CONF_DS6_ADDR_NBU    100
 #define UIP_CONF_DS6_MADDR_NBU   0
 #define UIP_CONF_DS6_AADDR_NBU   0
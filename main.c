@@ -32,6 +32,7 @@
 
 #include "ethdev.h"
 #include "sundev.h"
+#include "uringdev.h"
 #include "rpld.h"
 
 char *progname;
@@ -39,6 +40,16 @@ char  progbuf[PATH_MAX];
 
 PROCINIT(&tcpip_process);
 
+/* What the command line says about each interface, in -i order */
+struct ifopt {
+  char *name;
+  char *dagid;
+  char *prefix;
+  int non_storing;
+};
+static struct ifopt ifopts[UIP_DS6_LINK_NB];
+static int nifopts;
+
 static struct option const longopts[] =
 {
     { "help",      0, 0, '?'},
@@ -48,19 +59,82 @@ static struct option const longopts[] =
     { "rank",      1, NULL, 'r'},
     { "verbose",   0, 0, 'v'},
     { "daemon",    0, 0, 'D'},
+    { "io-uring",  0, 0, 'u'},
+    { "non-storing", 0, 0, 'n'},
+    { "netlink-thread", 1, NULL, 't'},
+    { "rx-thread", 1, NULL, 'T'},
     { name: 0 },
 };
 
 static void
 usage(void)
 {
-  fprintf (stderr, "Usage: %s -i ifname\n", progname);
+  fprintf (stderr, "Usage: %s -i ifname [-i ifname]...\n", progname);
   fprintf (stderr, "%s%s[-v] [--verbose]                 verbose\n", progbuf, progbuf);
   fprintf (stderr, "%s%s[-p prefix] [--prefix prefix]    announce this IPv6 prefix to the interface\n", progbuf, progbuf);
   fprintf (stderr, "%s%s[-d dagid] [--dagid dagid]       DAG ID to use\n", progbuf, progbuf);
 //  fprintf (stderr, "%s%s[-r rank] [--rank rank]          initial rank to announce\n", progbuf, progbuf);
   fprintf (stderr, "%s%s[?] [--help]                     print this help\n", progbuf, progbuf);
   fprintf (stderr, "%s%s[-D] [--daemon]                  run in background\n", progbuf, progbuf);
+  fprintf (stderr, "%s%s[-u] [--io-uring]                use io_uring for packet I/O\n", progbuf, progbuf);
+  fprintf (stderr, "%s%s[-n] [--non-storing]             run the DODAG in non-storing mode\n", progbuf, progbuf);
+  fprintf (stderr, "%s%s[-t cpu] [--netlink-thread cpu]  program kernel routes from a thread on this CPU\n", progbuf, progbuf);
+  fprintf (stderr, "%s%s[-T cpu] [--rx-thread cpu]       read packets from a thread on this CPU\n", progbuf, progbuf);
+  fprintf (stderr, "%s-p, -d and -n apply to the interface of the -i before them,\n", progbuf);
+  fprintf (stderr, "%sor to the first one when no -i came yet\n", progbuf);
+}
+
+/* The interface the per-interface options apply to */
+static struct ifopt *
+ifopt_current(void)
+{
+  if (nifopts == 0) {
+    nifopts = 1;
+  }
+  return &ifopts[nifopts - 1];
+}
+
+/* Set up an interface named on the command line */
+static struct interface *
+ifopt_apply(struct ifopt *o, int verbose, int rank)
+{
+  struct interface *iface;
+
+  iface = if_get_by_name(o->name);
+  if (iface == NULL) {
+    fprintf(stderr, "Can not find interface %s\n", o->name);
+    return NULL;
+  }
+  iface->verbose = verbose;
+  iface->non_storing = o->non_storing;
+  iface->flags |= RPLD_FLAGS;
+
+  if (o->dagid) {
+    iface->dagid = (struct in6_addr *) malloc(sizeof(struct in6_addr));
+    if (inet_pton(AF_INET6, o->dagid, iface->dagid) == 0) {
+      fprintf(stderr, "%s is not a valid RPL DAG ID\n", o->dagid);
+      return NULL;
+    }
+    fprintf(stderr, "%s: DAG id = %s\n", o->name, o->dagid);
+  }
+
+  if (o->prefix) {
+    iface->prefix = (struct in6_addr *) malloc(sizeof(struct in6_addr));
+    if (inet_pton(AF_INET6, o->prefix, iface->prefix) == 0) {
+      fprintf(stderr, "%s is not a valid IPv6 prefix\n", o->prefix);
+      return NULL;
+    }
+    fprintf(stderr, "%s: prefix %s\n", o->name, o->prefix);
+  }
+
+  if (rank) {
+    iface->metric = rank;
+  }
+
+  if (netdrv_attach(iface) < 0) {
+    return NULL;
+  }
+  return iface;
 }
 
 int
@@ -68,19 +142,19 @@ main(int argc, char *argv[])
 {
   int len;
   int i;
+  int ret;
   unsigned char ch;
   char *e;
   struct interface *iface;
   struct netdrv *netdrv;
 
-  char *iface_name;
-  char *dagid;
-  char *prefix;
+  struct ifopt *o;
   int rank;
   int instanceid;
   int interval;
   int verbose;
   int daemon;
+  int uring;
 
   /* Our process ID and Session ID */
   pid_t pid, sid;
@@ -114,26 +188,40 @@ main(int argc, char *argv[])
   interval = 0;
   verbose = 0;
   daemon = 0;
+  uring = 0;
   rank = 0;
   iface = NULL;
-  iface_name = NULL;
-  dagid = NULL;
-  prefix = NULL;
+  nifopts = 0;
 
   /*
    * process command line arguments
    */
-  while ((ch = getopt_long(argc,argv,"?hd:i:p:vD", longopts, 0)) != 0xff ) {
+  while ((ch = getopt_long(argc,argv,"?hd:i:p:t:T:vDun", longopts, 0)) != 0xff ) {
 
     switch (ch) {
-    case 'i':   /* interface name */
-      iface_name = optarg;
+    case 'i':   /* interface name, one -i per interface */
+      for (i=0; i<nifopts; i++) {
+        if (ifopts[i].name && strcmp(ifopts[i].name, optarg) == 0) {
+          fprintf (stderr, "%s: interface %s given twice\n", progname, optarg);
+          return 1;
+        }
+      }
+      if (nifopts > 0 && ifopts[nifopts - 1].name == NULL) {
+        /* Options came first, they belong to this one */
+        ifopts[nifopts - 1].name = optarg;
+        break;
+      }
+      if (nifopts == UIP_DS6_LINK_NB) {
+        fprintf (stderr, "%s: at most %d interfaces\n", progname, UIP_DS6_LINK_NB);
+        return 1;
+      }
+      ifopts[nifopts++].name = optarg;
       break;
     case 'p':   /* prefix */
-      prefix = optarg;
+      ifopt_current()->prefix = optarg;
       break;
     case 'd':   /* dag id */
-      dagid = optarg;
+      ifopt_current()->dagid = optarg;
       break;
     case 'r':   /* rank */
       rank = strtol(optarg, &e, 0);
@@ -142,12 +230,32 @@ main(int argc, char *argv[])
         return 1;
       }
       break;
+    case 't':   /* netlink thread CPU */
+      rpld_netlink_cpu = strtol(optarg, &e, 0);
+      if ((e == optarg) || (*e != 0) || rpld_netlink_cpu < 0) {
+        fprintf (stderr, "%s: invalid CPU specified '%s'\n", progname, optarg);
+        return 1;
+      }
+      break;
+    case 'T':   /* receive thread CPU */
+      ethdev_rx_cpu = strtol(optarg, &e, 0);
+      if ((e == optarg) || (*e != 0) || ethdev_rx_cpu < 0) {
+        fprintf (stderr, "%s: invalid CPU specified '%s'\n", progname, optarg);
+        return 1;
+      }
+      break;
     case 'v':
       verbose++;
       break;
     case 'D':
       daemon++;
       break;
+    case 'u':
+      uring++;
+      break;
+    case 'n':
+      ifopt_current()->non_storing++;
+      break;
     case '?':
     case 'h':
     default:
@@ -156,7 +264,7 @@ main(int argc, char *argv[])
     }
   }
 
-  if (iface_name == NULL) {
+  if (nifopts == 0 || ifopts[nifopts - 1].name == NULL) {
     usage();
     return 0;
   }
@@ -198,50 +306,52 @@ main(int argc, char *argv[])
 
   scan_net_devices(verbose);
 
-  iface = if_get_by_name(iface_name);
-  if (iface == NULL) {
-    fprintf(stderr, "Can not find interface %s\n", iface_name);
+  /* All the interfaces go through one driver, the one output function */
+  netdrv = &ethdrv;
+  for (i=0; i<nifopts; i++) {
+    if (strncmp(ifopts[i].name, "tap", 3) == 0) {
+      netdrv = &sundrv;
+    }
+  }
+  if (netdrv == &sundrv && nifopts > 1) {
+    fprintf(stderr, "%s can't serve tap interfaces along with others\n", progname);
     return 0;
   }
-
-  iface->verbose = verbose;
-  iface->flags |= RPLD_FLAGS;
-
-  if (dagid) {
-    iface->dagid = (struct in6_addr *) malloc(sizeof(struct in6_addr));
-    if (inet_pton(AF_INET6, dagid, iface->dagid) == 0) {
-      fprintf(stderr, "%s is not a valid RPL DAG ID\n", dagid);
-      return 0;
+  if (uring && netdrv == &ethdrv) {
+    if (nifopts == 1) {
+      netdrv = &uringdrv;
+    }
+    else {
+      fprintf(stderr, "%s serves a single interface, using %s\n",
+          uringdrv.name, ethdrv.name);
     }
-    fprintf(stderr, "DAG id = %s\n", dagid);
+  }
+  if (ethdev_rx_cpu >= 0 && netdrv != &ethdrv) {
+    fprintf(stderr, "%s has no receive thread\n", netdrv->name);
   }
 
-  if (prefix) {
-    iface->prefix = (struct in6_addr *) malloc(sizeof(struct in6_addr));
-    if (inet_pton(AF_INET6, prefix, iface->prefix) == 0) {
-      fprintf(stderr, "%s is not a valid IPv6 prefix\n", prefix);
+  for (i=0; i<nifopts; i++) {
+    o = &ifopts[i];
+    iface = ifopt_apply(o, verbose, rank);
+    if (iface == NULL) {
       return 0;
     }
-    fprintf(stderr, "prefix %s\n", prefix);
-  }
-
-  if (rank) {
-    iface->metric = rank;
-  }
 
-  if (strncmp(iface->name, "tap", 3) == 0) {
-    netdrv = &sundrv;
-  }
-  else {
-    netdrv = &ethdrv;
-  }
-  if (netdrv->init(iface) < 0) {
-    fprintf(stderr, "can't set up %s\n", iface_name);
-    return 0;
-  }
+    ret = netdrv->init(iface);
+    if (ret < 0 && netdrv == &uringdrv) {
+      fprintf(stderr, "io_uring not available, falling back to %s\n", ethdrv.name);
+      netdrv = &ethdrv;
+      ret = netdrv->init(iface);
+    }
+    if (ret < 0) {
+      fprintf(stderr, "can't set up %s\n", o->name);
+      return 0;
+    }
 
-  if (verbose > 2) {
-    fprintf(stderr, "interface index = %d\n", iface->ifindex);
+    if (verbose > 2) {
+      fprintf(stderr, "%s: interface index = %d, link %d\n",
+          iface->name, iface->ifindex, iface->link);
+    }
   }
 
   /* Init clock */
@@ -255,8 +365,8 @@ main(int argc, char *argv[])
   process_start(&etimer_process, NULL);
   ctimer_init();
 
-  /* Start border router process */
-  process_start(&border_router_process, (void *) iface);
+  /* Start border router process, it serves every attached interface */
+  process_start(&border_router_process, NULL);
   fprintf(stderr, "Border Router Process started\n");
 
   /* netdrv.setup starts the network process and sets the network output function */
@@ -10,19 +10,28 @@
  *
  */
 
+#define _GNU_SOURCE               /* for pthread_setaffinity_np() */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include <sys/socket.h>
+#include <sys/eventfd.h>
 
 #include <asm/types.h>
 #include <libnetlink.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
+#include <linux/lwtunnel.h>
+#include <linux/rpl.h>
+#include <linux/rpl_iptunnel.h>
 
 #include <arpa/inet.h>
 
@@ -30,33 +39,35 @@
 #include "contiki-net.h"
 #include "net/uip.h"
 #include "net/rpl/rpl.h"
+#include "net/rpl/rpl-private.h"
+#include "net/rpl/rpl-ns.h"
 #include "net/uip-ds6.h"
+#include "lib/ringbuf.h"
 
 #include "rpld.h"
 #include "ethdev.h"
-#include "prefix.h"
-#include "table.h"
 
 #define RTPROT_RPL     20
+#define RPL_SRH_TYPE   3          /* IPV6_SRCRT_TYPE_3 */
+#define NL_BATCH_SIZE  32768      /* Route messages sent in one write */
+#define NL_SLOTS       64         /* Messages in flight to the netlink thread */
+#define NL_RING_SIZE   128        /* Power of two above NL_SLOTS */
 
 extern  uip_ds6_route_t uip_ds6_routing_table[];
 
 static uint16_t dag_id[] = {0x1111, 0x1100, 0, 0, 0, 0, 0, 0x0011};
-static struct interface *iface;
+static int verbose;
 static struct rtnl_handle *rth;
+static struct rtnl_handle *rth_dump;
 
-enum {
-  ROUTE_NODE_CREATED,
-  ROUTE_NODE_UPDATED,
-  ROUTE_NODE_MODIFIED,
-  ROUTE_NODE_KERNEL
-};
-
-struct route_table *rt;
+/* CPU the netlink thread is pinned to, -1 to program from the main loop */
+int rpld_netlink_cpu = -1;
 
-struct route_node_info {
-  unsigned char metric;
-  char status;
+/* A route message as built by kernel_route_create() and _delete() */
+struct nl_req {
+  struct nlmsghdr n;
+  struct rtmsg r;
+  char buf[1024];
 };
 
 struct nlist {
@@ -67,74 +78,388 @@ struct nlist {
 };
 static struct nlist nl;
 
+/* Route messages waiting for netlink_send() */
+static char nl_batch[NL_BATCH_SIZE];
+static int nl_batch_len;
+
+/*
+ * With a netlink thread, the main loop fills message slots and passes
+ * their numbers on the full ring; the thread batches them into the
+ * kernel and gives the slots back on the free ring. Each ring has one
+ * writer and one reader, the thread sleeps on an eventfd. The main loop
+ * sleeps on another one, signalled after each batch, when it has to
+ * wait for the thread.
+ */
+static struct nl_req nl_slots[NL_SLOTS];
+static uint8_t nl_full_data[NL_RING_SIZE];
+static uint8_t nl_free_data[NL_RING_SIZE];
+static struct ringbuf nl_full;
+static struct ringbuf nl_free;
+static int nl_event = -1;
+static int nl_done_event = -1;
+static int nl_queued;
+static unsigned long nl_posted;        /* Slots posted by the main loop */
+static volatile unsigned long nl_done; /* Slots sent by the thread */
+static pthread_t nl_thread;
+
 /*---------------------------------------------------------------*/
-/* sendmsg() to netlink socket then recvmsg() */
+/* Kernel index of the interface an RPL instance runs on */
 static int
-netlink_talk(struct nlmsghdr *n, int len)
+instance_ifindex(rpl_instance_t *instance)
 {
-  int status;
+  struct interface *ni;
 
-  n->nlmsg_seq = ++nl.seq;
-  /* Request an acknowledgement by setting NLM_F_ACK */
-  n->nlmsg_flags |= NLM_F_ACK;
+  ni = netdrv_link(instance != NULL ? instance->link : 0);
+  return ni != NULL ? ni->ifindex : 0;
+}
+
+/*---------------------------------------------------------------*/
+/* Kernel index of the interface the next hop of a route is on */
+static int
+route_ifindex(uip_ds6_route_t *route)
+{
+  struct interface *ni;
+
+  ni = netdrv_link(uip_ds6_route_link(route));
+  return ni != NULL ? ni->ifindex : 0;
+}
+
+/*---------------------------------------------------------------*/
+/* Whether an interface is one of those served */
+static int
+served_ifindex(int ifindex)
+{
+  int i;
+
+  for (i=0; i<netdrv_nlinks(); i++) {
+    if (netdrv_link(i)->ifindex == ifindex) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*---------------------------------------------------------------*/
+/*
+ * Read back what the kernel answered to the messages sent. Only the
+ * failures are answered; left unread they would fill the socket.
+ */
+static void
+netlink_drain(void)
+{
+  char buf[8192];
+  struct nlmsghdr *h;
+  struct nlmsgerr *err;
+  int len;
+
+  while ((len = recv(rth->fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+    for (h = (struct nlmsghdr *) buf; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+      if (h->nlmsg_type != NLMSG_ERROR || verbose <= 2) {
+        continue;
+      }
+      err = (struct nlmsgerr *) NLMSG_DATA(h);
+      if (err->error) {
+        fprintf(stderr, "route message %u: %s\n", err->msg.nlmsg_seq,
+            strerror(-err->error));
+      }
+    }
+  }
+}
+
+/*---------------------------------------------------------------*/
+/* Send the batched messages to the netlink socket in one write */
+static int
+netlink_send(void)
+{
+  int status;
 
-  status = rtnl_send(rth, (char *) n, len);
+  if (nl_batch_len == 0) {
+    return 0;
+  }
+  status = rtnl_send(rth, nl_batch, nl_batch_len);
   if (status < 0) {
-    fprintf(stderr, "netlink_talk rtnl_send() error: %s\n", strerror(errno));
+    fprintf(stderr, "netlink_send rtnl_send() error: %s\n", strerror(errno));
+  }
+  else if (verbose > 2) {
+    fprintf(stderr, "sent %d bytes of route messages\n", nl_batch_len);
   }
+  nl_batch_len = 0;
 
-  // Insert here receive message
+  netlink_drain();
   return status;
 }
 
 /*---------------------------------------------------------------*/
+/* Add a message to the batch, sending the batch first when full */
+static int
+netlink_batch(struct nlmsghdr *n, int len)
+{
+  if (nl_batch_len + NLMSG_ALIGN(len) > NL_BATCH_SIZE &&
+      netlink_send() < 0) {
+    return -1;
+  }
+  memcpy(nl_batch + nl_batch_len, n, len);
+  nl_batch_len += NLMSG_ALIGN(len);
+  return 0;
+}
+
+/*---------------------------------------------------------------*/
+/* Wake the netlink thread up for the messages queued so far */
+static void
+netlink_kick(void)
+{
+  uint64_t one = 1;
+
+  if (nl_queued == 0) {
+    return;
+  }
+  if (write(nl_event, &one, sizeof(one)) < 0) {
+    perror("netlink thread wakeup");
+    exit(errno);
+  }
+  nl_queued = 0;
+}
+
+/*---------------------------------------------------------------*/
+/*
+ * The netlink thread: owns the route socket, drains the full ring into
+ * one batch per wakeup. Whatever the main loop queues while the batch
+ * is in the kernel goes with the next one.
+ */
+static void *
+netlink_thread(void *arg)
+{
+  uint64_t n, one = 1;
+  int slot;
+  int taken;
+
+  while (1) {
+    if (read(nl_event, &n, sizeof(n)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("netlink thread");
+      exit(errno);
+    }
+    taken = 0;
+    while ((slot = ringbuf_get(&nl_full)) >= 0) {
+      if (netlink_batch(&nl_slots[slot].n, nl_slots[slot].n.nlmsg_len) < 0) {
+        fprintf(stderr, "unrecoverable error\n");
+        exit(1);
+      }
+      ringbuf_put(&nl_free, slot);
+      taken++;
+    }
+    if (netlink_send() < 0) {
+      fprintf(stderr, "unrecoverable error\n");
+      exit(1);
+    }
+    /* Only now are the messages taken in the kernel */
+    __sync_fetch_and_add(&nl_done, taken);
+    if (write(nl_done_event, &one, sizeof(one)) < 0) {
+      perror("netlink thread signal");
+      exit(errno);
+    }
+  }
+  return NULL;
+}
+
+/*---------------------------------------------------------------*/
+/* Start the netlink thread, pinned to rpld_netlink_cpu */
+static void
+netlink_thread_start(void)
+{
+  cpu_set_t cpus;
+  int i;
+
+  ringbuf_init(&nl_full, nl_full_data, NL_RING_SIZE);
+  ringbuf_init(&nl_free, nl_free_data, NL_RING_SIZE);
+  for (i=0; i<NL_SLOTS; i++) {
+    ringbuf_put(&nl_free, i);
+  }
+
+  nl_event = eventfd(0, 0);
+  nl_done_event = eventfd(0, 0);
+  if (nl_event < 0 || nl_done_event < 0) {
+    perror("Cannot create eventfd");
+    exit(errno);
+  }
+  errno = pthread_create(&nl_thread, NULL, netlink_thread, NULL);
+  if (errno != 0) {
+    perror("Cannot start the netlink thread");
+    exit(errno);
+  }
+
+  CPU_ZERO(&cpus);
+  CPU_SET(rpld_netlink_cpu, &cpus);
+  errno = pthread_setaffinity_np(nl_thread, sizeof(cpus), &cpus);
+  if (errno != 0) {
+    fprintf(stderr, "can't pin the netlink thread to CPU %d: %s\n",
+        rpld_netlink_cpu, strerror(errno));
+  }
+  else if (verbose) {
+    fprintf(stderr, "netlink thread on CPU %d\n", rpld_netlink_cpu);
+  }
+}
+
+/*---------------------------------------------------------------*/
+/* Sleep until the netlink thread is done with a batch */
+static void
+netlink_wait(void)
+{
+  uint64_t n;
+
+  if (read(nl_done_event, &n, sizeof(n)) < 0 && errno != EINTR) {
+    perror("netlink thread wait");
+    exit(errno);
+  }
+}
+
+/*---------------------------------------------------------------*/
+/* Hand what a poll queued to the kernel */
+static int
+netlink_flush(void)
+{
+  if (nl_event >= 0) {
+    netlink_kick();
+    return 0;
+  }
+  return netlink_send();
+}
+
+/*---------------------------------------------------------------*/
+/*
+ * Hand what was queued to the kernel and wait until it is there, for
+ * a dump to reflect every message sent so far.
+ */
+static int
+netlink_sync(void)
+{
+  if (netlink_flush() < 0) {
+    return -1;
+  }
+  while (nl_event >= 0 && __sync_fetch_and_add(&nl_done, 0) != nl_posted) {
+    netlink_wait();
+  }
+  return 0;
+}
+
+/*---------------------------------------------------------------*/
+/* Queue a message for the netlink socket */
+static int
+netlink_talk(struct nlmsghdr *n, int len)
+{
+  int slot;
+
+  /* No NLM_F_ACK: the kernel only answers failures, see netlink_drain() */
+  n->nlmsg_seq = ++nl.seq;
+
+  if (nl_event < 0) {
+    return netlink_batch(n, len);
+  }
+
+  /* All slots in flight, let the thread catch up */
+  while ((slot = ringbuf_get(&nl_free)) < 0) {
+    netlink_kick();
+    netlink_wait();
+  }
+  memcpy(&nl_slots[slot], n, len);
+  ringbuf_put(&nl_full, slot);
+  nl_posted++;
+  if (++nl_queued == NL_SLOTS / 2) {
+    netlink_kick();
+  }
+  return 0;
+}
+
+/*---------------------------------------------------------------*/
+/*
+ * Add a RPL source routing header encapsulation to a route. The kernel
+ * sends to the first segment and carries the others, followed by the
+ * original destination, in the header.
+ */
+static int
+kernel_route_encap(struct nlmsghdr *n, int maxlen, uip_ipaddr_t *segs,
+                   int nsegs)
+{
+  struct ipv6_rpl_sr_hdr *srh;
+  struct rtattr *nest;
+  int srhlen;
+
+  srhlen = sizeof(*srh) + nsegs * sizeof(struct in6_addr);
+  srh = calloc(1, srhlen);
+  if (srh == NULL) {
+    perror("Cannot allocate memory");
+    return -1;
+  }
+  srh->type = RPL_SRH_TYPE;
+  srh->hdrlen = (nsegs * sizeof(struct in6_addr)) >> 3;
+  srh->segments_left = nsegs;
+  memcpy(srh->rpl_segaddr, segs, nsegs * sizeof(struct in6_addr));
+
+  addattr16(n, maxlen, RTA_ENCAP_TYPE, LWTUNNEL_ENCAP_RPL);
+  nest = addattr_nest(n, maxlen, RTA_ENCAP);
+  addattr_l(n, maxlen, RPL_IPTUNNEL_SRH, srh, srhlen);
+  addattr_nest_end(n, nest);
+
+  free(srh);
+  return 0;
+}
+
+/*---------------------------------------------------------------*/
+/*
+ * Install a route, or replace the one to the same destination. Storing
+ * mode routes go through a gateway, source routes carry the hops to
+ * their destination in segs, on-link ones have neither.
+ */
 static int
-kernel_route_create(struct route_node *node)
+kernel_route_create(int ifindex, uip_ipaddr_t *dst, int len,
+                    uip_ipaddr_t *gateway, int metric, uip_ipaddr_t *segs,
+                    int nsegs)
 {
   int bytelen;
-  struct route_node_info *rni;
 
-  struct {
-    struct nlmsghdr n;
-    struct rtmsg r;
-    char buf[1024];
-  } req;
+  struct nl_req req;
 
   memset(&req, 0, sizeof(req));
   bytelen = 16;
 
-  rni = node->aggregate;
-
   req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-  req.n.nlmsg_flags =  NLM_F_CREATE | NLM_F_REQUEST;
+  req.n.nlmsg_flags =  NLM_F_CREATE | NLM_F_REPLACE | NLM_F_REQUEST;
   req.n.nlmsg_type = RTM_NEWROUTE;
-  req.r.rtm_family = node->p.family;
-  req.r.rtm_dst_len = node->p.prefixlen;
+  req.r.rtm_family = AF_INET6;
+  req.r.rtm_dst_len = len;
 
   req.r.rtm_protocol = RTPROT_RPL;
   req.r.rtm_type = RTN_UNICAST;
   req.r.rtm_table = RT_TABLE_MAIN;
   req.r.rtm_scope = RT_SCOPE_LINK;
 
-  addattr_l(&req.n, sizeof(req), RTA_DST, node->p.u.val, bytelen);
-  addattr_l(&req.n, sizeof(req), RTA_GATEWAY, node->info, bytelen);
-  addattr32(&req.n, sizeof(req), RTA_OIF, iface->ifindex);
-  addattr32(&req.n, sizeof(req), RTA_PRIORITY, rni->metric);
+  addattr_l(&req.n, sizeof(req), RTA_DST, dst, bytelen);
+  if (gateway != NULL) {
+    addattr_l(&req.n, sizeof(req), RTA_GATEWAY, gateway, bytelen);
+  }
+  else if (nsegs > 0 &&
+           kernel_route_encap(&req.n, sizeof(req), segs, nsegs) < 0) {
+    return -1;
+  }
+  addattr32(&req.n, sizeof(req), RTA_OIF, ifindex);
+  addattr32(&req.n, sizeof(req), RTA_PRIORITY, metric);
 
   /* Talk to netlink socket */
   return netlink_talk(&req.n, req.n.nlmsg_len);
 }
 /*---------------------------------------------------------------*/
+/*
+ * Remove the RPL route to a destination, from the given interface or,
+ * with ifindex 0, from whichever has it.
+ */
 static int
-kernel_route_delete(struct route_node *node)
+kernel_route_delete(int ifindex, uip_ipaddr_t *dst, int len)
 {
   int bytelen;
 
-  struct {
-    struct nlmsghdr n;
-    struct rtmsg r;
-    char buf[1024];
-  } req;
+  struct nl_req req;
 
   memset(&req, 0, sizeof(req));
   bytelen = 16;
@@ -142,22 +467,114 @@ kernel_route_delete(struct route_node *node)
   req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
   req.n.nlmsg_flags =  NLM_F_CREATE | NLM_F_REQUEST;
   req.n.nlmsg_type = RTM_DELROUTE;
-  req.r.rtm_family = node->p.family;
-  req.r.rtm_dst_len = node->p.prefixlen;
+  req.r.rtm_family = AF_INET6;
+  req.r.rtm_dst_len = len;
 
   req.r.rtm_protocol = RTPROT_RPL;
   req.r.rtm_type = RTN_UNICAST;
   req.r.rtm_table = RT_TABLE_MAIN;
   req.r.rtm_scope = RT_SCOPE_LINK;
 
-  addattr_l(&req.n, sizeof(req), RTA_DST, node->p.u.val, bytelen);
-  addattr32(&req.n, sizeof(req), RTA_OIF, iface->ifindex);
+  addattr_l(&req.n, sizeof(req), RTA_DST, dst, bytelen);
+  if (ifindex != 0) {
+    addattr32(&req.n, sizeof(req), RTA_OIF, ifindex);
+  }
 
   /* Talk to netlink socket */
   return netlink_talk(&req.n, req.n.nlmsg_len);
 }
 
+/*---------------------------------------------------------------*/
+/*
+ * Install the route of a storing mode table entry, on the interface its
+ * next hop was learned on.
+ */
+static int
+kernel_route_table(uip_ds6_route_t *route, uip_ipaddr_t *dst)
+{
+  if (verbose > 2) {
+    char dst_addr[INET6_ADDRSTRLEN], gw_addr[INET6_ADDRSTRLEN];
+
+    inet_ntop(AF_INET6, dst, dst_addr, INET6_ADDRSTRLEN);
+    inet_ntop(AF_INET6, uip_ds6_route_nexthop(route), gw_addr,
+              INET6_ADDRSTRLEN);
+    fprintf(stderr, "route to %s/%d via %s", dst_addr, route->length, gw_addr);
+    if (verbose > 3) {
+      fprintf(stderr, ", metric:%d, lifetime:%us, saved lifetime:%us, learned from:%d",
+          route->metric, (unsigned)rpl_route_lifetime(route),
+          route->state.saved_lifetime,
+          route->state.learned_from);
+    }
+    fprintf(stderr, "\n");
+  }
+  return kernel_route_create(route_ifindex(route), dst, route->length,
+                             uip_ds6_route_nexthop(route), route->metric,
+                             NULL, 0);
+}
+
+/*---------------------------------------------------------------*/
+/*
+ * Install the source route to a node of the non-storing graph. Returns
+ * 1 when the node does not reach the root, the caller then removes it.
+ */
+static int
+kernel_route_srcrt(rpl_ns_node_t *ns)
+{
+  uip_ipaddr_t hops[RPL_NS_MAX_HOPS];
+  int nhops;
+
+  nhops = rpl_ns_get_path(ns, hops, RPL_NS_MAX_HOPS);
+  if (nhops < 0) {
+    return 1;
+  }
+  if (verbose > 2) {
+    char dst_addr[INET6_ADDRSTRLEN];
+
+    inet_ntop(AF_INET6, &ns->addr, dst_addr, INET6_ADDRSTRLEN);
+    fprintf(stderr, "route to %s/128", dst_addr);
+    if (nhops > 0) {
+      fprintf(stderr, ", source route of %d hops", nhops + 1);
+    }
+    if (verbose > 3) {
+      fprintf(stderr, ", lifetime:%us", (unsigned)rpl_ns_lifetime(ns));
+    }
+    fprintf(stderr, "\n");
+  }
+  /* Neighbors of the root are on-link, the others get a RPL SRH */
+  return kernel_route_create(instance_ifindex(ns->dag ? ns->dag->instance : NULL),
+                             &ns->addr, 128, NULL, 0, hops, nhops);
+}
+
+/*---------------------------------------------------------------*/
+/*
+ * Whether the RPL core has a route to dst/len through an interface,
+ * looked up through the indexes of the route stores.
+ */
+static int
+br_route_wanted(int ifindex, uip_ipaddr_t *dst, int len)
+{
+  uip_ds6_route_t *locroute;
+  rpl_ns_node_t *ns;
+  uip_ipaddr_t hops[RPL_NS_MAX_HOPS];
+
+  locroute = uip_ds6_route_find(dst, len);
+  if (locroute != NULL && route_ifindex(locroute) == ifindex) {
+    return 1;
+  }
+  if (len != 128) {
+    return 0;
+  }
+  for(ns = rpl_ns_addr_head(dst); ns != NULL; ns = rpl_ns_addr_next(ns)) {
+    if (instance_ifindex(ns->dag ? ns->dag->instance : NULL) == ifindex &&
+        rpl_ns_get_path(ns, hops, RPL_NS_MAX_HOPS) >= 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 /*----------------------------------------------------------------------*/
+/* Remove the RPL routes of the interfaces the RPL core does not have */
 static int
 kernel_route_get(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 {
@@ -166,13 +583,7 @@ kernel_route_get(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
   int len = n->nlmsg_len;
   struct rtattr * tb[RTA_MAX+1];
   int index = -1;
-  int metric = 0;
-  void *dest = NULL;
-  void *gate = NULL;
-
-  struct route_node_info *rni;
-  struct route_node *node;
-  struct prefix p;
+  uip_ipaddr_t dest;
 
   if (n->nlmsg_type != RTM_NEWROUTE && n->nlmsg_type != RTM_DELROUTE) {
           fprintf(stderr, "Not a route: %08x %08x %08x\n",
@@ -191,55 +602,34 @@ kernel_route_get(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 
   if (tb[RTA_OIF]) {
     index = * (int *) RTA_DATA(tb[RTA_OIF]);
-    iface = if_get_active();
-    if (iface == NULL || iface->ifindex != index) {
-      return 0;
-    }
-  }
-
-  if (tb[RTA_DST]) {
-    dest = RTA_DATA(tb[RTA_DST]);
-  }
-
-  if (tb[RTA_GATEWAY]) {
-    gate = RTA_DATA(tb[RTA_GATEWAY]);
   }
-
-  if (tb[RTA_PRIORITY]) {
-    metric = *(int *) RTA_DATA(tb[RTA_PRIORITY]);
+  if (!served_ifindex(index)) {
+    return 0;
   }
 
   if (r->rtm_flags & RTM_F_CLONED) {
     return 0;
   }
 
-  if (r->rtm_protocol != RTPROT_RPL) {
+  if (r->rtm_protocol != RTPROT_RPL || r->rtm_family != AF_INET6) {
     return 0;
   }
 
-  p.family = AF_INET6;
-  p.prefixlen = r->rtm_dst_len;
-  IPV6_ADDR_COPY(&p.u, dest);
-  node = route_node_get(rt, &p);
-  if (gate) {
-    node->info = malloc(sizeof(struct in6_addr));
-    IPV6_ADDR_COPY(node->info, gate);
-  }
-  node->aggregate = malloc(sizeof(struct route_node_info));
-  rni = (struct route_node_info *) node->aggregate;
-  rni->status = ROUTE_NODE_KERNEL;
-  rni->metric = metric;
-  route_node_lock(node);
-  if(iface->verbose > 2) {
-    char dst[INET6_ADDRSTRLEN], src[INET6_ADDRSTRLEN];
-
-    inet_ntop(AF_INET6, dest, dst, INET6_ADDRSTRLEN);
-    if (gate) {
-      inet_ntop(AF_INET6, gate, src, INET6_ADDRSTRLEN);
-    } else {
-      memcpy(src, "unkown", strlen("unknown"));
+  memset(&dest, 0, sizeof(dest));
+  if (tb[RTA_DST]) {
+    memcpy(&dest, RTA_DATA(tb[RTA_DST]), sizeof(dest));
+  }
+
+  if (!br_route_wanted(index, &dest, r->rtm_dst_len)) {
+    if(verbose > 2) {
+      char dst[INET6_ADDRSTRLEN];
+
+      inet_ntop(AF_INET6, &dest, dst, INET6_ADDRSTRLEN);
+      fprintf(fp, "deleting kernel route %s/%d\n", dst, r->rtm_dst_len);
+    }
+    if (kernel_route_delete(index, &dest, r->rtm_dst_len) < 0) {
+      return -1;
     }
-    fprintf(fp, "from kernel route %s/%d via %s\n", dst, p.prefixlen, src);
   }
 
   fflush(fp);
@@ -248,68 +638,94 @@ kernel_route_get(const struct sockaddr_nl *who, struct nlmsghdr *n, void *arg)
 }
 
 /*---------------------------------------------------------------*/
+/*
+ * Bring the kernel in line with the RPL core after the change log lost
+ * track, and at start: drop the RPL routes the core does not have, then
+ * install all of its own.
+ */
 static void
-kernel_route_update(void)
+kernel_route_resync(void)
 {
-  struct route_node *node;
-  struct route_node_info *ni;
-  char addr[INET6_ADDRSTRLEN];
-  int status = 0;
-
-  for (node = route_top(rt); node != NULL; node = route_next(node)) {
-    if (node->info == NULL)
-      continue;
-    inet_ntop(AF_INET6, &node->p.u.prefix6, addr, INET6_ADDRSTRLEN);
-    ni = (struct route_node_info *) node->aggregate;
-    if (ni == NULL) {
-      fprintf(stderr, "network interface missing in the table\n");
-      continue;
-    }
-    switch(ni->status) {
-    case ROUTE_NODE_CREATED:
-      if (iface->verbose > 2) {
-        fprintf(stderr, "creating route node %s\n", addr);
-      }
-      status = kernel_route_create(node);
-      break;
-    case ROUTE_NODE_MODIFIED:
-      if (iface->verbose > 2) {
-        fprintf(stderr, "changing route node %s\n", addr);
-      }
-      status = kernel_route_delete(node);
-      if (status < 0) {
+  uip_ds6_route_t *locroute;
+  rpl_ns_node_t *ns;
+  uip_ipaddr_t dst;
+
+  if (verbose > 2) {
+    fprintf(stderr, "synchronizing all routes with the kernel\n");
+  }
+  /* A route still in flight would be missing from the dump */
+  if (netlink_sync() < 0) {
+    fprintf(stderr, "unrecoverable error\n");
+    exit(1);
+  }
+  if(rtnl_wilddump_request(rth_dump, AF_INET6, RTM_GETROUTE) < 0) {
+    perror("Cannot send dump request");
+    exit(errno);
+  }
+  if(rtnl_dump_filter(rth_dump, (rtnl_filter_t) kernel_route_get,
+      stderr /*, NULL, NULL*/) < 0) {
+    fprintf(stderr, "Dump terminated\n");
+    exit(errno);
+  }
+
+  for(locroute = uip_ds6_routing_table;
+      locroute < uip_ds6_routing_table + UIP_DS6_ROUTE_NB; locroute++) {
+    if (locroute->isused) {
+      uip_ds6_route_ipaddr(locroute, &dst);
+      if (kernel_route_table(locroute, &dst) < 0) {
         fprintf(stderr, "unrecoverable error\n");
         exit(1);
       }
-      status = kernel_route_create(node);
-      break;
-    case ROUTE_NODE_KERNEL:
-      if (iface->verbose > 2) {
-        fprintf(stderr, "kernel route node %s\n", addr);
-      }
-      route_node_lock(node);
-      break;
-    default:
-      break;
     }
-    if (status < 0) {
+  }
+  for(ns = rpl_ns_node_head(); ns != NULL; ns = rpl_ns_node_next(ns)) {
+    if (kernel_route_srcrt(ns) < 0) {
       fprintf(stderr, "unrecoverable error\n");
       exit(1);
     }
-    if ((node->lock == 0)) {
-      if (iface->verbose > 2) {
-        fprintf(stderr, "deleting route node %s\n", addr);
-      }
-      status = kernel_route_delete(node);
-      if (status < 0) {
-        fprintf(stderr, "unrecoverable error\n");
-        exit(1);
-      }
-      free (node->info);
-      node->info = NULL;
-      route_node_delete(node);
+  }
+}
+
+/*---------------------------------------------------------------*/
+/*
+ * Apply a logged change: install the route its slot holds, or delete
+ * the logged target when the slot was freed or now holds another one.
+ */
+static void
+kernel_route_change(uip_ds6_route_change_t *change)
+{
+  uip_ds6_route_t *route;
+  rpl_ns_node_t *ns;
+  int status;
+
+  status = 1;
+  if (change->store == UIP_DS6_ROUTE_TABLE) {
+    route = &uip_ds6_routing_table[change->slot];
+    if (route->isused &&
+        uip_ds6_route_cmp(route, &change->ipaddr, change->length)) {
+      status = kernel_route_table(route, &change->ipaddr);
     }
   }
+  else {
+    ns = rpl_ns_get_slot(change->slot);
+    if (ns != NULL && uip_ipaddr_cmp(&ns->addr, &change->ipaddr)) {
+      status = kernel_route_srcrt(ns);
+    }
+  }
+
+  if (status > 0) {
+    if (verbose > 2) {
+      char addr[INET6_ADDRSTRLEN];
+
+      inet_ntop(AF_INET6, &change->ipaddr, addr, INET6_ADDRSTRLEN);
+      fprintf(stderr, "deleting route to %s/%d\n", addr, change->length);
+    }
+    status = kernel_route_delete(0, &change->ipaddr, change->length);
+  }
+  if (status < 0) {
+    fprintf(stderr, "unrecoverable error\n");
+    exit(1);
+  }
 }
 
 /*---------------------------------------------------------------*/
@@ -321,114 +737,57 @@ br_init(void)
   /* Initialize nl */
   memset(&nl, 0, sizeof(nl));
 
-  /* Allocate route table */
-  rt = route_table_init();
-  rt->top = NULL;
-
   /* Create rtnetlink handle */
   rth = (struct rtnl_handle *) malloc (sizeof(struct rtnl_handle));
   if (rth == NULL) {
     perror("Cannot allocate memory");
     exit(errno);
   }
-
   fd = rtnl_open(rth, 0);
   if (fd < 0) {
     fprintf (stderr, "Cannot open rtnetlink.\n");
     free(rth);
     exit(errno);
   }
-  if(rtnl_wilddump_request(rth, AF_INET6, RTM_GETROUTE) < 0) {
-    perror("Cannot send dump request");
-    free(rth);
+
+  /*
+   * Dumps go through a handle of their own, where no answer to a route
+   * message can come between the dump's parts.
+   */
+  rth_dump = (struct rtnl_handle *) malloc (sizeof(struct rtnl_handle));
+  if (rth_dump == NULL) {
+    perror("Cannot allocate memory");
     exit(errno);
   }
-  if(rtnl_dump_filter(rth, (rtnl_filter_t) kernel_route_get,
-      stderr /*, NULL, NULL*/) < 0) {
-    fprintf(stderr, "Flush terminated\n");
-    free(rth);
+  if (rtnl_open(rth_dump, 0) < 0) {
+    fprintf (stderr, "Cannot open rtnetlink.\n");
     exit(errno);
   }
+
+  if (rpld_netlink_cpu >= 0) {
+    netlink_thread_start();
+  }
 }
 
 /*---------------------------------------------------------------*/
+/* Hand the route changes of the RPL core to the kernel */
 static void
 br_poll(void)
 {
-  uip_ds6_route_t *locroute;
-  struct route_node *node;
+  uip_ds6_route_change_t change;
 
-  route_table_unlock(rt);
- for(locroute = uip_ds6_routing_table;
-      locroute < uip_ds6_routing_table + UIP_DS6_ROUTE_NB; locroute++) {
-    if((locroute->isused)) {
-      struct prefix p;
-      struct route_node_info *rni;
-      int new;
-
-      new = 0;
-      p.family = AF_INET6;
-      p.prefixlen = locroute->length;
-      IPV6_ADDR_COPY(&p.u, &locroute->ipaddr);
-
-      node = route_node_lookup(rt, &p);
-      if (node == NULL) {
-        new = 1;
-        node = route_node_get(rt, &p);
-      }
-      route_node_lock(node);
-
-      if (new) {
-        rni = (struct route_node_info *) malloc(sizeof(struct route_node_info));
-        rni->metric = locroute->metric;
-        rni->status = ROUTE_NODE_CREATED;
-        if (iface->verbose > 2) {
-          fprintf(stderr, "adding new route to table\n");
-        }
-        node->aggregate = rni;
-        node->info = malloc(sizeof(struct in6_addr));
-      }
-      else {
-        rni = (struct route_node_info *) node->aggregate;
-        if (iface->verbose > 2) {
-          fprintf(stderr, "route found in table, metric %d - ", rni->metric);
-        }
-        if (IPV6_ADDR_SAME(node->info, &locroute->nexthop)) {
-          rni->status = ROUTE_NODE_UPDATED;
-          if (iface->verbose > 2) {
-            fprintf(stderr, "same next hop\n");
-          }
-        }
-        else {
-          rni->status = ROUTE_NODE_MODIFIED;
-          if (iface->verbose > 2) {
-            fprintf(stderr, "next hop modified\n");
-          }
-        }
-      }
-
-      IPV6_ADDR_COPY(node->info, &locroute->nexthop);
-
-      if (iface->verbose > 2) {
-        char src_addr[INET6_ADDRSTRLEN], dst_addr[INET6_ADDRSTRLEN];
-
-        inet_ntop(AF_INET6, &node->p.u.prefix6, dst_addr, INET6_ADDRSTRLEN);
-        inet_ntop(AF_INET6, node->info, src_addr, INET6_ADDRSTRLEN);
-        fprintf(stderr, "route to %s/%d via %s",
-                dst_addr, node->p.prefixlen, src_addr);
-        if (iface->verbose > 3) {
-          fprintf(stderr, ", metric:%d, lifetime:%us, saved lifetime:%us, learned from:%d",
-              locroute->metric, locroute->state.lifetime, locroute->state.saved_lifetime,
-              locroute->state.learned_from);
-        }
-        fprintf(stderr, "\n");
-      }
-    }
+  if (uip_ds6_route_log_lost()) {
+    kernel_route_resync();
   }
-  if (iface->verbose > 2) {
-    route_node_dump(rt);
+  while (uip_ds6_route_log_next(&change)) {
+    kernel_route_change(&change);
+  }
+
+  /* Everything a poll changed goes to the kernel in one go */
+  if (netlink_flush() < 0) {
+    fprintf(stderr, "unrecoverable error\n");
+    exit(1);
   }
-  kernel_route_update();
 }
 
 /*------------------------------------------------------------------*/
@@ -439,54 +798,100 @@ br_exit(void)
 }
 
 /*------------------------------------------------------------------*/
-
-PROCESS(border_router_process, "RPL Border Router");
-
-PROCESS_THREAD(border_router_process, ev, data)
+/*
+ * Make the process the DODAG root of an interface. Each interface runs
+ * its own RPL instance on its own uIP link; instance and default DAG ID
+ * are those of the first one plus the link number.
+ */
+static void
+br_setup(struct interface *ni)
 {
   rpl_dag_t *dag;
-  char buf[sizeof(dag_id)];
+  uint16_t buf[sizeof(dag_id) / sizeof(dag_id[0])];
   uip_ipaddr_t ipaddr;
 
-  PROCESS_POLLHANDLER(br_poll());
-  PROCESS_EXITHANDLER(br_exit());
-
-  PROCESS_BEGIN();
+  uip_ds6_set_link(ni->link);
 
-  iface = (struct interface *) data;
-
-  /* Configure MAC address */
-  memcpy(&uip_lladdr.addr, &iface->eui48, sizeof(uip_lladdr.addr));
+  /* uip_ds6_init() gave the first link its link-local address */
+  if (ni->link > 0) {
+    uip_create_linklocal_prefix(&ipaddr);
+    uip_ds6_set_addr_iid(&ipaddr, &uip_lladdr);
+    uip_ds6_addr_add(&ipaddr, 0, ADDR_AUTOCONF);
+  }
 
   /* Configure global IPV6 address */
-  if (iface->prefix) {
-    memcpy(&ipaddr, iface->prefix, sizeof(struct in6_addr));
+  if (ni->prefix) {
+    memcpy(&ipaddr, ni->prefix, sizeof(struct in6_addr));
   }
   else {
-    memcpy(&ipaddr, &iface->if_gaddr[0], sizeof(struct in6_addr));
+    memcpy(&ipaddr, &ni->if_gaddr[0], sizeof(struct in6_addr));
   }
 
   uip_ds6_addr_add(&ipaddr, 0, ADDR_AUTOCONF);
 
   /* Configure DAG id */
-  if (iface->dagid) {
-    memcpy(buf, iface->dagid, sizeof(struct in6_addr));
+  if (ni->dagid) {
+    memcpy(buf, ni->dagid, sizeof(struct in6_addr));
   }
   else {
     memcpy(buf, dag_id, sizeof(dag_id));
+    buf[7] += ni->link;
   }
-//  if (iface->metric == 0) {
+//  if (ni->metric == 0) {
     /* Set up DODAG root */
-    dag = rpl_set_root(RPL_DEFAULT_INSTANCE, (uip_ip6addr_t *)buf);
+    dag = rpl_set_root(RPL_DEFAULT_INSTANCE + ni->link, (uip_ip6addr_t *)buf);
+    if (dag == NULL) {
+      fprintf(stderr, "can't set up the DODAG of %s\n", ni->name);
+      exit(1);
+    }
+    if (ni->non_storing) {
+      /* Nodes report their parents, the kernel source routes to them */
+      dag->instance->mop = RPL_MOP_NON_STORING;
+      rpl_dio_invalidate(dag->instance);
+    }
     /* Set up RPL prefix */
     rpl_set_prefix(dag, &ipaddr, 64);
 //  }
 
+  if (verbose) {
+    fprintf(stderr, "(%s) - RPL instance %u on link %d\n", ni->name,
+        RPL_DEFAULT_INSTANCE + ni->link, ni->link);
+  }
+}
+
+/*------------------------------------------------------------------*/
+
+PROCESS(border_router_process, "RPL Border Router");
+
+PROCESS_THREAD(border_router_process, ev, data)
+{
+  struct interface *ni;
+  int i;
+
+  PROCESS_POLLHANDLER(br_poll());
+  PROCESS_EXITHANDLER(br_exit());
+
+  PROCESS_BEGIN();
+
+  ni = netdrv_link(0);
+  verbose = ni->verbose;
+
+  /* Configure MAC address, uip_ds6_init() derives the link-local from it */
+  memcpy(&uip_lladdr.addr, &ni->eui48, sizeof(uip_lladdr.addr));
+
+  /* Let the TCP/IP process initialize uIP and RPL first */
+  PROCESS_PAUSE();
+
+  for (i=0; i<netdrv_nlinks(); i++) {
+    br_setup(netdrv_link(i));
+  }
+
   br_init();
+  br_poll();
 
   while(1) {
+    /* The driver already fed the burst to uIP, sync routes once for all of it */
     PROCESS_WAIT_EVENT_UNTIL(ev == ethnet_event);
-    tcpip_input();
     br_poll();
   }
 
@@ -17,6 +17,9 @@
 
 PROCESS_NAME(border_router_process);
 
+/* CPU of the thread programming the kernel routes, -1 for none */
+extern int rpld_netlink_cpu;
+
 
 /* RPLD message types. */
 #define RPLD_INTERFACE_ADD                1